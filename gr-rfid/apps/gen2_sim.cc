@@ -0,0 +1,142 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Sweeps the Gen2 MAC simulator over all the combinations of the given values
+ * and writes one CSV row per configuration.
+ *
+ *   gen2_sim --tags 10,100,500 --q 2,4,6,8 --session 0,1 --policy fixed,adaptive --out sweep.csv
+ */
+
+#include <rfid/gen2_sim.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+using namespace gr::rfid;
+
+static std::vector<float> parse_list(const char * arg)
+{
+  std::vector<float> values;
+  std::stringstream ss(arg);
+  std::string item;
+  while (std::getline(ss, item, ','))
+  {
+    if (item == "fixed")
+      values.push_back(SIM_Q_FIXED);
+    else if (item == "adaptive")
+      values.push_back(SIM_Q_ADAPTIVE);
+    else
+      values.push_back(atof(item.c_str()));
+  }
+  return values;
+}
+
+static void usage()
+{
+  std::cerr << "usage: gen2_sim [--tags N,..] [--q Q,..] [--policy fixed|adaptive,..] [--session S,..]" << std::endl
+            << "                [--tari US,..] [--blf HZ,..] [--capture DB,..] [--ber P,..] [--access N,..]" << std::endl
+            << "                [--turnaround US,..] [--seeds N] [--time S] [--threads N] [--out FILE]" << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+  gen2_sim_config base = gen2_sim_default_config();
+  std::vector<float> tags(1, base.n_tags), q(1, base.q), policy(1, base.q_policy), session(1, base.session),
+                     tari(1, base.tari_us), blf(1, base.blf_hz), capture(1, base.capture_db), ber(1, base.ber),
+                     access(1, base.n_access_ops), turnaround(1, base.turnaround_us);
+  int n_seeds = 1, n_threads = 0;
+  std::string out_file;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc)
+    {
+      usage();
+      return 1;
+    }
+    const char * opt = argv[i], * val = argv[++i];
+    if      (!strcmp(opt, "--tags"))       tags       = parse_list(val);
+    else if (!strcmp(opt, "--q"))          q          = parse_list(val);
+    else if (!strcmp(opt, "--policy"))     policy     = parse_list(val);
+    else if (!strcmp(opt, "--session"))    session    = parse_list(val);
+    else if (!strcmp(opt, "--tari"))       tari       = parse_list(val);
+    else if (!strcmp(opt, "--blf"))        blf        = parse_list(val);
+    else if (!strcmp(opt, "--capture"))    capture    = parse_list(val);
+    else if (!strcmp(opt, "--ber"))        ber        = parse_list(val);
+    else if (!strcmp(opt, "--access"))     access     = parse_list(val);
+    else if (!strcmp(opt, "--turnaround")) turnaround = parse_list(val);
+    else if (!strcmp(opt, "--seeds"))      n_seeds    = atoi(val);
+    else if (!strcmp(opt, "--time"))       base.duration_us = atof(val) * 1e6;
+    else if (!strcmp(opt, "--threads"))    n_threads  = atoi(val);
+    else if (!strcmp(opt, "--out"))        out_file   = val;
+    else
+    {
+      usage();
+      return 1;
+    }
+  }
+
+  // Cartesian product of all the lists
+  std::vector<gen2_sim_config> configs;
+  gen2_sim_config c = base;
+  for (int a = 0; a < tags.size(); a++)
+  for (int b = 0; b < q.size(); b++)
+  for (int d = 0; d < policy.size(); d++)
+  for (int e = 0; e < session.size(); e++)
+  for (int f = 0; f < tari.size(); f++)
+  for (int g = 0; g < blf.size(); g++)
+  for (int h = 0; h < capture.size(); h++)
+  for (int j = 0; j < ber.size(); j++)
+  for (int k = 0; k < access.size(); k++)
+  for (int l = 0; l < turnaround.size(); l++)
+  for (int seed = 1; seed <= n_seeds; seed++)
+  {
+    c.n_tags        = tags[a];
+    c.q             = q[b];
+    c.q_policy      = SIM_Q_POLICY(int(policy[d]));
+    c.session       = session[e];
+    c.tari_us       = tari[f];
+    c.blf_hz        = blf[g];
+    c.capture_db    = capture[h];
+    c.ber           = ber[j];
+    c.n_access_ops  = access[k];
+    c.turnaround_us = turnaround[l];
+    c.seed          = seed;
+    configs.push_back(c);
+  }
+
+  std::cerr << "Simulating " << configs.size() << " configurations of " << base.duration_us / 1e6 << " s" << std::endl;
+  std::vector<gen2_sim_result> results = gen2_sweep(configs, n_threads);
+
+  std::ofstream file;
+  if (!out_file.empty())
+    file.open(out_file.c_str());
+  std::ostream & out = out_file.empty() ? std::cout : file;
+
+  gen2_sim_csv_header(out);
+  for (int i = 0; i < configs.size(); i++)
+    gen2_sim_csv_row(out, configs[i], results[i]);
+  return 0;
+}
@@ -46,6 +46,7 @@ class reader_top_block(gr.top_block):
     gr.top_block.__init__(self)
 
 
+    # DEPLOY_PROFILE (global_vars.h) pins the gate, decoder and reader to isolated cores with SCHED_FIFO
     #rt = gr.enable_realtime_scheduling() 
 
     ######## Variables #########
@@ -65,19 +66,18 @@ class reader_top_block(gr.top_block):
     self.num_taps     = [1] * 25 # matched to half symbol period
 
     ######## File sinks for debugging (1 for each block) #########
+    # Full streams fill the disk quickly, CAPTURE_FILE (global_vars.h) records only the Tag reply windows
     self.file_sink_source         = blocks.file_sink(gr.sizeof_gr_complex*1, "../misc/data/source", False)
     self.file_sink_matched_filter = blocks.file_sink(gr.sizeof_gr_complex*1, "../misc/data/matched_filter", False)
-    self.file_sink_gate           = blocks.file_sink(gr.sizeof_gr_complex*1, "../misc/data/gate", False)
+    self.file_sink_gate           = blocks.file_sink(gr.sizeof_int*1,        "../misc/data/gate", False) # Burst arena slots
     self.file_sink_decoder        = blocks.file_sink(gr.sizeof_gr_complex*1, "../misc/data/decoder", False)
-    self.file_sink_reader         = blocks.file_sink(gr.sizeof_float*1,      "../misc/data/reader", False)
+    self.file_sink_reader         = blocks.file_sink(gr.sizeof_gr_complex*1, "../misc/data/reader", False)
 
     ######## Blocks #########
     self.matched_filter = filter.fir_filter_ccc(self.decim, self.num_taps);
     self.gate            = rfid.gate(int(self.adc_rate/self.decim))
     self.tag_decoder    = rfid.tag_decoder(int(self.adc_rate/self.decim))
-    self.reader          = rfid.reader(int(self.adc_rate/self.decim),int(self.dac_rate))
-    self.amp              = blocks.multiply_const_ff(self.ampl)
-    self.to_complex      = blocks.float_to_complex()
+    self.reader          = rfid.reader(int(self.adc_rate/self.decim),int(self.dac_rate),self.ampl)  # Shaped complex baseband
 
     if (DEBUG == False) : # Real Time Execution
 
@@ -91,9 +91,7 @@ class reader_top_block(gr.top_block):
 
       self.connect(self.gate, self.tag_decoder)
       self.connect((self.tag_decoder,0), self.reader)
-      self.connect(self.reader, self.amp)
-      self.connect(self.amp, self.to_complex)
-      self.connect(self.to_complex, self.sink)
+      self.connect(self.reader, self.sink)
 
       #File sinks for logging (Remove comments to log data)
       #self.connect(self.source, self.file_sink_source)
@@ -107,9 +105,7 @@ class reader_top_block(gr.top_block):
       self.connect(self.matched_filter, self.gate)
       self.connect(self.gate, self.tag_decoder)
       self.connect((self.tag_decoder,0), self.reader)
-      self.connect(self.reader, self.amp)
-      self.connect(self.amp, self.to_complex)
-      self.connect(self.to_complex, self.file_sink)
+      self.connect(self.reader, self.file_sink)
     
     #File sinks for logging 
     #self.connect(self.gate, self.file_sink_gate)
@@ -0,0 +1,145 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Reads and compacts the journal written by the reader (JOURNAL_FILE).
+ *
+ *   rfid_journal dump FILE [--from US] [--to US]    one CSV row per record
+ *   rfid_journal summary FILE                       reads, first and last time per Tag
+ *   rfid_journal compact IN OUT [--window US]       drops corrupt records, merges repeated reads
+ */
+
+#include <rfid/journal.h>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+using namespace gr::rfid;
+
+static void usage()
+{
+  std::cerr << "usage: rfid_journal dump FILE [--from US] [--to US]" << std::endl
+            << "       rfid_journal summary FILE" << std::endl
+            << "       rfid_journal compact IN OUT [--window US]" << std::endl;
+}
+
+// Value of --name in argv[first..], def if absent
+static uint64_t option(int argc, char ** argv, int first, const char * name, uint64_t def)
+{
+  for (int i = first; i + 1 < argc; i++)
+    if (!strcmp(argv[i], name))
+      return strtoull(argv[i + 1], NULL, 10);
+  return def;
+}
+
+static int dump(const journal_reader & journal, uint64_t from_us, uint64_t to_us)
+{
+  std::cout << "time_us,seq,type,antenna,op,ref,count,ampl,phase,valid,data" << std::endl;
+  for (uint64_t i = journal.seek(from_us); i < journal.size() && journal[i].time_us < to_us; i++)
+  {
+    const journal_record & r = journal[i];
+    std::cout << r.time_us << "," << r.seq << "," << (r.type == JOURNAL_EPC ? "epc" : "mem") << ","
+              << int(r.antenna) << "," << int(r.op) << "," << r.ref << "," << r.count << ","
+              << r.ampl << "," << r.phase << "," << (r.check == r.checksum()) << "," << r.bits().to_hex() << std::endl;
+  }
+  return 0;
+}
+
+struct tag_summary
+{
+  uint64_t reads, first_us, last_us;
+};
+
+static int summary(const journal_reader & journal)
+{
+  std::map<epc_bits, tag_summary> tags;
+  uint64_t n_mem = 0, n_corrupt = 0;
+
+  for (uint64_t i = 0; i < journal.size(); i++)
+  {
+    const journal_record & r = journal[i];
+    if (r.check != r.checksum())
+    {
+      n_corrupt++;
+      continue;
+    }
+    if (r.type != JOURNAL_EPC)
+    {
+      n_mem++;
+      continue;
+    }
+
+    std::map<epc_bits, tag_summary>::iterator it = tags.find(r.bits());
+    if (it == tags.end())
+    {
+      tag_summary t = {0, r.time_us, r.time_us};
+      it = tags.insert(std::make_pair(r.bits(), t)).first;
+    }
+    it->second.reads  += std::max<uint32_t>(r.count, 1);
+    it->second.last_us = r.time_us;
+  }
+
+  std::cout << "records " << journal.size() << ", tags " << tags.size() << ", memory reads " << n_mem
+            << ", corrupt " << n_corrupt << std::endl;
+  std::cout << "epc,reads,first_us,last_us" << std::endl;
+  for (std::map<epc_bits, tag_summary>::iterator it = tags.begin(); it != tags.end(); it++)
+    std::cout << it->first.to_hex() << "," << it->second.reads << "," << it->second.first_us << "," << it->second.last_us << std::endl;
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  if (argc < 3)
+  {
+    usage();
+    return 1;
+  }
+  std::string cmd = argv[1];
+
+  if (cmd == "compact" && argc >= 4)
+  {
+    journal_compact_stats stats;
+    if (!journal_compact(argv[2], argv[3], option(argc, argv, 4, "--window", 0), stats))
+    {
+      std::cerr << "Cannot compact " << argv[2] << " into " << argv[3] << std::endl;
+      return 1;
+    }
+    std::cerr << "records in " << stats.n_in << ", out " << stats.n_out << ", merged " << stats.n_merged
+              << ", corrupt " << stats.n_corrupt << std::endl;
+    return 0;
+  }
+
+  journal_reader journal;
+  if (!journal.open(argv[2]))
+  {
+    std::cerr << "Cannot open journal " << argv[2] << std::endl;
+    return 1;
+  }
+  if (cmd == "dump")
+    return dump(journal, option(argc, argv, 3, "--from", 0), option(argc, argv, 3, "--to", ~uint64_t(0)));
+  if (cmd == "summary")
+    return summary(journal);
+
+  usage();
+  return 1;
+}
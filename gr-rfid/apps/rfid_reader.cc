@@ -0,0 +1,434 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Headless reader : the flowgraph of reader.py without the Python interpreter, driven
+ * through a local UNIX-domain socket.
+ *
+ *   rfid_reader [--config FILE] [--socket PATH] [--start]
+ *
+ * One command per connection, answered with "ok" or "error" and some text :
+ *
+ *   start    builds and starts the flowgraph (new inventory, reader state reset)
+ *   stop     stops it and answers with the results
+ *   stats    results of the running (or last) inventory
+ *   reload   rereads the config file, frequency and gains apply immediately,
+ *            the other keys at the next start
+ *   quit     stops the flowgraph and exits (as SIGINT/SIGTERM)
+ *
+ *   echo stats | socat - UNIX-CONNECT:/tmp/rfid_reader.sock
+ */
+
+#include <rfid/gate.h>
+#include <rfid/tag_decoder.h>
+#include <rfid/reader.h>
+#include <rfid/global_vars.h>
+#include <gnuradio/top_block.h>
+#include <gnuradio/uhd/usrp_source.h>
+#include <gnuradio/uhd/usrp_sink.h>
+#include <gnuradio/blocks/file_source.h>
+#include <gnuradio/blocks/file_sink.h>
+#include <gnuradio/blocks/null_sink.h>
+#include <gnuradio/filter/fir_filter_ccc.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace gr::rfid;
+
+// Defaults of reader.py
+struct reader_config
+{
+  double dac_rate, adc_rate, freq, rx_gain, tx_gain;
+  int    decim, n_taps;
+  float  ampl;
+  std::string usrp_source, usrp_sink, rx_antenna, tx_antenna;
+  std::string file_source, file_sink, decoder_file;   // Offline traces and debug output
+  std::string socket;
+
+  reader_config()
+    : dac_rate(1e6), adc_rate(100e6/50), freq(910e6), rx_gain(20), tx_gain(0), decim(5), n_taps(25), ampl(0.1),
+      usrp_source("addr=192.168.10.2,recv_frame_size=256"), usrp_sink("addr=192.168.10.2,recv_frame_size=256"),
+      rx_antenna("RX2"), tx_antenna("TX/RX"), socket("/tmp/rfid_reader.sock") {}
+};
+
+static volatile sig_atomic_t quit_requested = 0;
+
+static void on_signal(int)
+{
+  quit_requested = 1;
+}
+
+static std::string trim(const std::string & s)
+{
+  size_t first = s.find_first_not_of(" \t\r"), last = s.find_last_not_of(" \t\r");
+  return first == std::string::npos ? "" : s.substr(first, last - first + 1);
+}
+
+// "key = value" lines, '#' starts a comment. The config is left unchanged on error.
+static bool load_config(const std::string & path, reader_config & config, std::string & error)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+  {
+    error = "cannot open " + path;
+    return false;
+  }
+
+  reader_config c = config;
+  std::string line;
+  for (int n = 1; std::getline(in, line); n++)
+  {
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+    size_t eq = line.find('=');
+    std::string key = trim(line.substr(0, eq)), value = eq == std::string::npos ? "" : trim(line.substr(eq + 1));
+    std::ostringstream where;
+    where << path << ":" << n << " ";
+
+    if (eq == std::string::npos || value.empty())
+    {
+      error = where.str() + "expected key = value";
+      return false;
+    }
+    if      (key == "dac_rate")     c.dac_rate     = atof(value.c_str());
+    else if (key == "adc_rate")     c.adc_rate     = atof(value.c_str());
+    else if (key == "decim")        c.decim        = atoi(value.c_str());
+    else if (key == "taps")         c.n_taps       = atoi(value.c_str());
+    else if (key == "ampl")         c.ampl         = atof(value.c_str());
+    else if (key == "freq")         c.freq         = atof(value.c_str());
+    else if (key == "rx_gain")      c.rx_gain      = atof(value.c_str());
+    else if (key == "tx_gain")      c.tx_gain      = atof(value.c_str());
+    else if (key == "usrp_source")  c.usrp_source  = value;
+    else if (key == "usrp_sink")    c.usrp_sink    = value;
+    else if (key == "rx_antenna")   c.rx_antenna   = value;
+    else if (key == "tx_antenna")   c.tx_antenna   = value;
+    else if (key == "file_source")  c.file_source  = value;
+    else if (key == "file_sink")    c.file_sink    = value;
+    else if (key == "decoder_file") c.decoder_file = value;
+    else if (key == "socket")       c.socket       = value;
+    else
+    {
+      error = where.str() + "unknown key " + key;
+      return false;
+    }
+  }
+
+  if (c.decim < 1 || c.n_taps < 1 || c.adc_rate <= 0 || c.dac_rate <= 0)
+  {
+    error = path + " : rates, decim and taps must be positive";
+    return false;
+  }
+  config = c;
+  return true;
+}
+
+/*
+ * The flowgraph of reader.py. Blocks are only kept while it runs, a new gate
+ * initializes a new reader state that is released once they are destroyed.
+ */
+class reader_flowgraph
+{
+  public:
+    reader_flowgraph() : d_running(false) {}
+
+    bool running() const { return d_running; }
+
+    // UHD and file errors (no device, busy device, missing file) are returned in error
+    bool start(const reader_config & c, std::string & error)
+    {
+      try
+      {
+        build(c);
+      }
+      catch (const std::exception & e)
+      {
+        release();
+        error = e.what();
+        return false;
+      }
+      d_running = true;
+      return true;
+    }
+
+    // Returns the results of the inventory
+    std::string stop()
+    {
+      d_tb->stop();
+      d_tb->wait();
+      d_results = d_reader->results();
+      release();
+      return d_results;
+    }
+
+    std::string stats() const
+    {
+      if (!d_running)
+        return d_results;
+      std::string status = reader_state->status == TERMINATED ? "terminated" : "running";
+      return "inventory " + status + d_reader->results();
+    }
+
+    // Settings that apply without restarting the flowgraph
+    void tune(const reader_config & c)
+    {
+      if (!d_usrp_source)
+        return;
+      d_usrp_source->set_center_freq(c.freq, 0);
+      d_usrp_source->set_gain(c.rx_gain, 0);
+      d_usrp_sink->set_center_freq(c.freq, 0);
+      d_usrp_sink->set_gain(c.tx_gain, 0);
+    }
+
+  private:
+    void build(const reader_config & c)
+    {
+      int sample_rate = int(c.adc_rate / c.decim);
+      d_tb      = gr::make_top_block("rfid_reader");
+      d_filter  = gr::filter::fir_filter_ccc::make(c.decim, std::vector<gr_complex>(c.n_taps, 1));
+      d_gate    = gate::make(sample_rate);
+      d_decoder = tag_decoder::make(sample_rate);
+      d_reader  = reader::make(sample_rate, int(c.dac_rate), c.ampl);
+
+      gr::basic_block_sptr source, sink;
+      if (c.file_source.empty())
+      {
+        d_usrp_source = gr::uhd::usrp_source::make(::uhd::device_addr_t(c.usrp_source), ::uhd::stream_args_t("fc32"));
+        d_usrp_source->set_samp_rate(c.adc_rate);
+        d_usrp_source->set_antenna(c.rx_antenna, 0);
+        d_usrp_sink = gr::uhd::usrp_sink::make(::uhd::device_addr_t(c.usrp_sink), ::uhd::stream_args_t("fc32"));
+        d_usrp_sink->set_samp_rate(c.dac_rate);
+        d_usrp_sink->set_antenna(c.tx_antenna, 0);
+        tune(c);
+        source = d_usrp_source;
+        sink   = d_usrp_sink;
+      }
+      else
+      {
+        source = gr::blocks::file_source::make(sizeof(gr_complex), c.file_source.c_str(), false);
+        if (c.file_sink.empty())
+          sink = gr::blocks::null_sink::make(sizeof(gr_complex));
+        else
+          sink = gr::blocks::file_sink::make(sizeof(gr_complex), c.file_sink.c_str(), false);
+      }
+
+      // The debug output of the decoder must be connected
+      gr::basic_block_sptr decoder_sink;
+      if (c.decoder_file.empty())
+        decoder_sink = gr::blocks::null_sink::make(sizeof(gr_complex));
+      else
+        decoder_sink = gr::blocks::file_sink::make(sizeof(gr_complex), c.decoder_file.c_str(), false);
+
+      d_tb->connect(source, 0, d_filter, 0);
+      d_tb->connect(d_filter, 0, d_gate, 0);
+      d_tb->connect(d_gate, 0, d_decoder, 0);
+      d_tb->connect(d_decoder, 0, d_reader, 0);
+      d_tb->connect(d_reader, 0, sink, 0);
+      d_tb->connect(d_decoder, 1, decoder_sink, 0);
+      d_tb->start();
+    }
+
+    // The blocks go before the reader state that the gate initialized
+    void release()
+    {
+      d_tb.reset();
+      d_filter.reset();
+      d_gate.reset();
+      d_decoder.reset();
+      d_reader.reset();
+      d_usrp_source.reset();
+      d_usrp_sink.reset();
+      release_reader_state();
+      d_running = false;
+    }
+
+    bool d_running;
+    std::string d_results;
+    gr::top_block_sptr d_tb;
+    gr::basic_block_sptr d_filter;
+    gate::sptr d_gate;
+    tag_decoder::sptr d_decoder;
+    reader::sptr d_reader;
+    gr::uhd::usrp_source::sptr d_usrp_source;
+    gr::uhd::usrp_sink::sptr d_usrp_sink;
+};
+
+static int listen_socket(const std::string & path)
+{
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path))
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  unlink(path.c_str());
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// First line sent by the client, a silent client is dropped after the receive timeout
+static std::string read_command(int fd)
+{
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string command;
+  char c;
+  while (command.size() < 64 && recv(fd, &c, 1, 0) == 1 && c != '\n')
+    command += c;
+  return trim(command);
+}
+
+static void reply(int fd, bool ok, const std::string & text)
+{
+  std::string msg = std::string(ok ? "ok" : "error") + (text.empty() ? "" : " ") + text + "\n";
+  for (size_t sent = 0; sent < msg.size(); )
+  {
+    ssize_t n = send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+      return;
+    sent += n;
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  std::string config_file, socket_path;
+  bool autostart = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--config") && i + 1 < argc)
+      config_file = argv[++i];
+    else if (!strcmp(argv[i], "--socket") && i + 1 < argc)
+      socket_path = argv[++i];
+    else if (!strcmp(argv[i], "--start"))
+      autostart = true;
+    else
+    {
+      std::cerr << "usage: rfid_reader [--config FILE] [--socket PATH] [--start]" << std::endl;
+      return 1;
+    }
+  }
+
+  reader_config config;
+  std::string error;
+  if (!config_file.empty() && !load_config(config_file, config, error))
+  {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  // Kept for the lifetime of the daemon, a reload does not move the socket
+  if (socket_path.empty())
+    socket_path = config.socket;
+
+  int listen_fd = listen_socket(socket_path);
+  if (listen_fd < 0)
+  {
+    std::cerr << "Cannot listen on " << socket_path << " : " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  reader_flowgraph flowgraph;
+  if (autostart && !flowgraph.start(config, error))
+    std::cerr << "Cannot start : " << error << std::endl;
+  std::cerr << "rfid_reader listening on " << socket_path << std::endl;
+
+  while (!quit_requested)
+  {
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 500) <= 0)
+      continue;
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+
+    std::string command = read_command(fd);
+    if (command == "start")
+    {
+      if (flowgraph.running())
+        reply(fd, false, "already running");
+      else if (!flowgraph.start(config, error))
+        reply(fd, false, error);
+      else
+        reply(fd, true, "");
+    }
+    else if (command == "stop")
+    {
+      if (flowgraph.running())
+        reply(fd, true, flowgraph.stop());
+      else
+        reply(fd, false, "not running");
+    }
+    else if (command == "stats")
+      reply(fd, true, flowgraph.stats());
+    else if (command == "reload")
+    {
+      if (config_file.empty())
+        reply(fd, false, "no config file");
+      else if (!load_config(config_file, config, error))
+        reply(fd, false, error);
+      else
+      {
+        if (flowgraph.running())
+          flowgraph.tune(config);
+        reply(fd, true, "");
+      }
+    }
+    else if (command == "quit")
+    {
+      reply(fd, true, "");
+      quit_requested = 1;
+    }
+    else
+      reply(fd, false, "unknown command " + command);
+    close(fd);
+  }
+
+  if (flowgraph.running())
+    std::cout << flowgraph.stop();
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  return 0;
+}
@@ -0,0 +1,95 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_EPC_BITS_H
+#define INCLUDED_RFID_EPC_BITS_H
+
+#include <rfid/api.h>
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+namespace gr {
+  namespace rfid {
+
+    // XPC_W1 + XPC_W2 + PC + 496 bit EPC + CRC16
+    const int EPC_MAX_BITS  = 576;
+    const int EPC_MAX_WORDS = EPC_MAX_BITS / 64;
+
+    /*!
+     * \brief Bit-packed Tag reply (RN16, PC + EPC + CRC16 or EPC only), MSB first.
+     *
+     * Bits are stored in uint64_t words, unused bits are always zero so that
+     * comparison and hashing work on whole words. Fixed size, no allocations,
+     * can be passed as a stream item between blocks.
+     */
+    class RFID_API epc_bits
+    {
+      public:
+        epc_bits() : d_size(0) { clear(); }
+        epc_bits(uint64_t value, int n_bits) : d_size(0) { clear(); append(value, n_bits); }
+
+        void clear();
+        int size() const { return d_size; }
+        int operator[](int i) const { return (d_words[i >> 6] >> (63 - (i & 63))) & 1; }
+
+        void push_back(int bit);
+        void append(uint64_t value, int n_bits);
+
+        // Up to 64 bits starting at bit first (MSB first)
+        uint64_t value(int first, int n_bits) const;
+        epc_bits sub(int first, int n_bits) const;
+
+        // Reply layout PC + [XPC_W1 + [XPC_W2]] + EPC + CRC16
+        uint16_t pc() const { return value(0, 16); }
+        int pc_epc_bits() const { return 16 * (pc() >> 11); } // EPC length announced by the PC
+        // XPC words after the PC : XI (PC bit 0x200) announces XPC_W1, XEB (its MSB) XPC_W2.
+        // Both are assumed while XPC_W1 has not been received.
+        int xpc_words() const;
+        // Length of the whole reply announced by the PC (without the dummy bit), needs at least the PC
+        int reply_bits() const { return 16 + 16 * xpc_words() + pc_epc_bits() + 16; }
+        epc_bits epc() const;
+
+        // CRC-16 of the first n_bits, and check of the CRC-16 in the last 16 bits
+        uint16_t crc16(int n_bits) const;
+        bool check_crc() const;
+
+        size_t hash() const;
+        std::string to_hex() const;
+
+        bool operator==(const epc_bits & other) const;
+        bool operator!=(const epc_bits & other) const { return !(*this == other); }
+        bool operator<(const epc_bits & other) const;
+
+      private:
+        uint64_t d_words[EPC_MAX_WORDS];
+        int d_size;
+    };
+
+    // For hashed containers
+    struct epc_bits_hash
+    {
+      size_t operator()(const epc_bits & bits) const { return bits.hash(); }
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_EPC_BITS_H */
@@ -31,7 +31,8 @@ namespace gr {
      * \brief The block is responsible for identifying a reader's command
      * 
      * The samples related to a reader's command are blocked and consumed. 
-     * Samples that belong to a Tag's message (RN16-EPC) are forwarded to the next block for further processing.
+     * Samples that belong to a Tag's message (RN16-EPC) are written, DC offset removed, to the burst arena
+     * and the index of the arena slot is forwarded to the next block for further processing.
      * \ingroup rfid
      *
      */
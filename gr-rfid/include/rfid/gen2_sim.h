@@ -0,0 +1,96 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_GEN2_SIM_H
+#define INCLUDED_RFID_GEN2_SIM_H
+
+#include <rfid/api.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace gr {
+  namespace rfid {
+
+    enum SIM_Q_POLICY {SIM_Q_FIXED, SIM_Q_ADAPTIVE};
+
+    struct gen2_sim_config
+    {
+      // Population
+      int   n_tags;
+      float capture_db;        // Strongest reply decoded in a collision if it exceeds the second by this much
+      float rssi_spread_db;    // Tag amplitudes uniform in [0, rssi_spread_db]
+      float ber;               // Bit error rate of the Tag -> reader link
+      float cmd_error;         // Probability that a Tag misses a reader command
+
+      // Link timing (defaults from global_vars.h)
+      float tari_us;
+      float blf_hz;
+      float t1_us, t2_us;
+      float turnaround_us;     // Host latency added to each reply window (decoder -> reader)
+
+      // MAC
+      int   q;
+      SIM_Q_POLICY q_policy;
+      int   session;
+      bool  flip_target;
+      int   n_access_ops;      // Reads after each EPC
+      int   read_words;
+      float s1_persistence_us; // S1 flags revert to A after this time
+      bool  s0_reset;          // Carrier drops between rounds, S0 flags revert to A
+
+      float duration_us;       // Simulated time
+      uint32_t seed;
+    };
+
+    struct gen2_sim_result
+    {
+      uint64_t n_queries, n_slots, n_empty, n_collisions, n_captures;
+      uint64_t n_epc, n_epc_fail, n_mem_reads;
+      int   n_unique;
+      float reads_per_s;
+      float first_full_read_us;  // Time when every Tag has been read once (-1 if never)
+      float airtime_efficiency;  // Time of EPC replies / total time
+    };
+
+    // Defaults from the reader configuration
+    RFID_API gen2_sim_config gen2_sim_default_config();
+
+    /*!
+     * \brief Discrete-event model of the reader MAC and a Tag population.
+     *
+     * The reader side is the gen2_mac engine of the reader blocks, command durations
+     * are those of the PIE waveforms produced by the reader and CW durations follow
+     * the reader's CW windows. Tags implement slot counters, inventoried flags per
+     * session, capture effect, link errors and S1 persistence.
+     */
+    RFID_API gen2_sim_result gen2_simulate(const gen2_sim_config & config);
+
+    // Runs all the configurations on n_threads threads (0 : all cores)
+    RFID_API std::vector<gen2_sim_result> gen2_sweep(const std::vector<gen2_sim_config> & configs, int n_threads);
+
+    RFID_API void gen2_sim_csv_header(std::ostream & out);
+    RFID_API void gen2_sim_csv_row(std::ostream & out, const gen2_sim_config & config, const gen2_sim_result & result);
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_GEN2_SIM_H */
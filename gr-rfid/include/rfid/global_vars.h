@@ -22,48 +22,139 @@
 #define INCLUDED_RFID_GLOBAL_VARS_H
 
 #include <rfid/api.h>
+#include <rfid/epc_bits.h>
+#include <gnuradio/gr_complex.h>
+#include <algorithm>
 #include <map>
-#include <sys/time.h>
+#include <set>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
 
 namespace gr {
   namespace rfid {
 
+    class metrics_registry;
+    class burst_arena;
+    class gen2_mac;
+    class journal_writer;
+    class burst_capture;
+    class command_log;
+
     enum STATUS               {RUNNING, TERMINATED};
-    enum GEN2_LOGIC_STATUS  {SEND_QUERY, SEND_ACK, SEND_QUERY_REP, IDLE, SEND_CW, START, SEND_QUERY_ADJUST, SEND_NAK_QR, SEND_NAK_Q, POWER_DOWN}; 
-    enum GATE_STATUS        {GATE_OPEN, GATE_CLOSED, GATE_SEEK_RN16, GATE_SEEK_EPC};  
-    enum DECODER_STATUS     {DECODER_DECODE_RN16, DECODER_DECODE_EPC};
+    enum GEN2_LOGIC_STATUS  {SEND_QUERY, SEND_ACK, SEND_QUERY_REP, IDLE, SEND_CW, START, SEND_QUERY_ADJUST, SEND_NAK_QR, SEND_NAK_Q, POWER_DOWN, SEND_SELECT, SEND_REQ_RN, SEND_READ}; 
+    enum GATE_STATUS        {GATE_OPEN, GATE_CLOSED, GATE_SEEK_RN16, GATE_SEEK_EPC, GATE_SEEK_HANDLE, GATE_SEEK_READ};  
+    enum DECODER_STATUS     {DECODER_DECODE_RN16, DECODER_DECODE_EPC, DECODER_DECODE_HANDLE, DECODER_DECODE_READ};
+
+    const int PHASE_HISTORY = 32;   // Phases kept per Tag and antenna (direction of motion)
+
+    // Channel estimate cache entry (one per Tag and antenna)
+    struct TAG_CHANNEL
+    {
+      gr_complex h;         // Last refined channel estimate
+      gr_complex h_avg;     // Smoothed channel estimate (phase history)
+      float      ampl_avg;  // Smoothed amplitude (RSSI)
+      int        n_reads;
+      // Ring of the phases of the last reads (refined estimate), oldest at phase_head once full
+      float      phase_hist[PHASE_HISTORY];
+      uint64_t   phase_time_us[PHASE_HISTORY];
+      int        phase_head;
+    };
+
+    // Read times of a Tag, RX time of its EPC replies (us since the epoch)
+    struct TAG_TIMES
+    {
+      uint64_t first_us, last_us;
+      uint64_t interval_min_us, interval_max_us, interval_sum_us;
+      int      n_reads;
+    };
     
+    // Counters are written by one block and read by the others (and by results()), the
+    // containers are guarded by READER_STATE::inventory_mutex
     struct READER_STATS
     {
-      int n_queries_sent;
+      boost::atomic<uint64_t> n_queries_sent;
 
-      int cur_inventory_round;
-      int cur_slot_number;
+      boost::atomic<int> cur_inventory_round;
+      boost::atomic<int> cur_slot_number;
 
-      int max_slot_number;
-      int max_inventory_round;
+      boost::atomic<int> max_slot_number;
+      boost::atomic<int> max_inventory_round;
 
-      int n_epc_correct;
+      boost::atomic<uint64_t> n_epc_correct;
+
+      boost::atomic<int> n_collisions;             // RN16 slots with two superimposed replies
+      boost::atomic<int> n_collisions_recovered;   // Collided slots that led to a correct EPC
       
 
-      std::vector<int>  unique_tags_round;
-       std::map<int,int> tag_reads;    
+      std::deque<int>   unique_tags_round;  // Unique Tags read in each of the last ROUND_HISTORY rounds
+      // Inventory keyed by EPC
+      std::map<epc_bits,int> tag_reads;    
+      boost::atomic<int>     n_unique_tags;      // tag_reads.size(), read without the lock by the gate
+      std::set<epc_bits>     tags_cur_round;
+      std::map<epc_bits,int> tag_last_round;     // Last inventory round in which each Tag was read
+      std::map<int, std::set<epc_bits> > tags_by_round;  // Same, by round (least recently read Tags first)
+
+      // Key : (EPC, antenna)
+      std::map<std::pair<epc_bits,int>, TAG_CHANNEL> tag_channels;
+      std::map<epc_bits, TAG_TIMES> tag_times;
+
+      boost::atomic<int> n_selects_sent;
+
+      boost::atomic<int> n_false_triggers;   // Commands detected while no Tag reply was expected
+      boost::atomic<int> n_missed_triggers;  // Tag reply windows for which no command was detected
+      boost::atomic<int> n_lost_commands;      // Sent commands never demodulated by the gate (GATE_COMMAND_DECODER)
+      boost::atomic<int> n_duplicate_commands; // Demodulated commands that match no pending sent command
+
+      boost::atomic<int> n_handles;          // Correct Req_RN replies
+      boost::atomic<int> n_mem_reads;        // Correct Read replies
+      boost::atomic<int> n_mem_read_fail;    // Read replies with CRC/handle errors or an error code
+      // Key : (EPC, index in ACCESS_OPS), value : memory words read
+      std::map<std::pair<epc_bits,int>, epc_bits> tag_memory;
+
+      boost::atomic<uint64_t> start_us, end_us;  // Monotonic (metrics_registry::now_us)
+      boost::atomic<uint64_t> epc_airtime_us;    // Duration of the correct EPC replies
+    };
 
-      struct timeval start, end; 
+    // Access phase of the singulated Tag
+    struct ACCESS_STATE
+    {
+      boost::atomic<uint16_t> rn16;    // RN16 acknowledged in the current slot
+      boost::atomic<uint16_t> handle;  // Handle from Req_RN
+      boost::atomic<int>      op;      // Current entry of ACCESS_OPS
+      epc_bits epc;         // EPC of the singulated Tag (DECODER block only)
+      uint32_t journal_seq; // Journal record of the EPC read (under inventory_mutex)
     };
 
     struct READER_STATE
     {
-      STATUS               status;
-      GEN2_LOGIC_STATUS   gen2_logic_status;
-      GATE_STATUS         gate_status;
-      DECODER_STATUS       decoder_status;
+      // Shared by the threads of the three blocks
+      boost::atomic<STATUS>             status;
+      boost::atomic<GEN2_LOGIC_STATUS>  gen2_logic_status;
+      boost::atomic<GATE_STATUS>        gate_status;
+      boost::atomic<DECODER_STATUS>     decoder_status;
       READER_STATS         reader_stats;
 
+      boost::atomic<int> cur_antenna; // Antenna used for the current inventory round
+      boost::atomic<int> cur_target;  // Inventoried flag (A/B) addressed by the Query
+      ACCESS_STATE access;
+
+      gen2_mac * mac;               // Inventory/access state machine, driven by the DECODER block
+      metrics_registry * metrics;   // Rolling window counters
+      boost::atomic<uint64_t> tag_reply_end_us;  // Monotonic time at which the gate closed (T2 check)
+      boost::atomic<int> epc_reply_bits;         // Length of the current EPC reply read from its PC by the GATE (0 : not yet)
+      journal_writer * journal;     // Persistent log of read events (NULL : disabled)
+      // Guards the inventory of reader_stats (tag_reads, tags_cur_round, tag_last_round, tags_by_round,
+      // tag_channels, tag_times, tag_memory, unique_tags_round) while the EPC worker of the decoder updates it
+      boost::mutex inventory_mutex;
 
 
-      std::vector<float> magn_squared_samples; // used for sync
-      int n_samples_to_ungate; // used by the GATE and DECODER block
+      burst_arena * bursts;    // Tag replies passed from the GATE to the DECODER block
+      burst_capture * capture; // Triggered IQ capture of the bursts (NULL : disabled)
+      command_log * commands;  // Commands sent by the READER, checked by the GATE
+      boost::atomic<int> n_samples_to_ungate; // used by the GATE and DECODER block
     };
 
     // CONSTANTS (READER CONFIGURATION)
@@ -95,27 +186,65 @@ namespace gr {
     const int DELIM_D       = 12;      // A preamble shall comprise a fixed-length start delimiter 12.5us +/-5%
     const int TRCAL_D     = 200;    // BLF = DR/TRCAL => 40e3 = 8/TRCAL => TRCAL = 200us
     const int RTCAL_D     = 72;      // 6*PW = 72us
+    const float PIE_EDGE_D = 2;       // Raised-cosine edge of the PIE symbols (rise time <= 0.33 Tari)
 
     const int NUM_PULSES_COMMAND = 5;       // Number of pulses to detect a reader command
     const int NUMBER_UNIQUE_TAGS = 100;      // Stop after NUMBER_UNIQUE_TAGS have been read 
 
+    // Continuous inventory : no termination, target A/B flipping on S1-S3, bounded memory
+    const bool CONTINUOUS_INVENTORY = false;
+    const int  MAX_TRACKED_TAGS     = 10000;    // Least recently read Tags are evicted beyond this
+    const int  ROUND_HISTORY        = 1000;     // Rounds kept in unique_tags_round
+    const int  STATS_WINDOW_D       = 1000000;  // Throughput report / metrics export period (us)
+
+    // Deployment profile of the RX -> decode -> TX loop : gate, tag_decoder and reader pinned to
+    // isolated cores (isolcpus) with SCHED_FIFO, memory locked, buffers sized to the reader bursts.
+    // Needs CAP_SYS_NICE and CAP_IPC_LOCK (or rtprio/memlock limits), else it is only logged.
+    const bool DEPLOY_PROFILE       = false;
+    const int  DEPLOY_CORES[3]      = {1, 2, 3};  // Gate, tag_decoder, reader (-1 : not pinned)
+    const int  DEPLOY_RT_PRIORITY   = 80;         // SCHED_FIFO priority of the three block threads
+
+    // EPC validation, inventory and statistics run on a worker thread of the decoder, only the
+    // RN16 -> ACK path stays on the scheduler thread (the access phase is always synchronous)
+    const bool EPC_WORKER           = false;
+
+    // Metrics in Prometheus text format are written to this file (empty : disabled)
+    const char METRICS_FILE[]       = "";
+    // Read events are appended to this journal file (empty : disabled), see rfid/journal.h
+    const char JOURNAL_FILE[]       = "";
+    const int  JOURNAL_COMMIT_MS    = 100;      // Group commit period, the decoder never waits for the disk
+    // Tag reply windows are recorded to CAPTURE_FILE.sigmf-data/.sigmf-meta (empty : disabled)
+    const char CAPTURE_FILE[]       = "";
+    const bool CAPTURE_FAILED_ONLY  = true;     // Only collisions and failed EPC/handle/Read decodes
+    const int  CAPTURE_PRE_D        = 400;      // Pre-trigger samples before the gate opens (us)
+    const int  CAPTURE_MAX_BURSTS   = 10000;    // Bounds the size of a capture
+    // |h|^2 / mean energy of the RN16 samples below which a slot is counted as empty
+    const float EMPTY_SLOT_RATIO    = 0.5;
+
 
     // Number of bits
     const int PILOT_TONE          = 12;  // Optional
     const int TAG_PREAMBLE_BITS  = 6;   // Number of preamble bits
     const int RN16_BITS          = 17;  // Dummy bit at the end
     const int EPC_BITS            = 129;  // PC + EPC + CRC16 + Dummy = 6 + 16 + 96 + 16 + 1 = 135
+    // The length of an EPC reply is announced by its PC word (and XPC words). The gate ungates
+    // EPC_HEADER_BITS first, then the announced length, EPC_BITS is the nominal 96 bit reply.
+    const int EPC_HEADER_BITS     = 16 + 16;           // PC + XPC_W1
+    const int EPC_MAX_REPLY_BITS  = 16 * 3 + 496 + 16 + 1;  // PC + XPC_W1 + XPC_W2 + 496 bit EPC + CRC16 + Dummy
     const int QUERY_LENGTH        = 22;  // Query length in bits
     
     const int T_READER_FREQ = 40e3;     // BLF = 40kHz
     const float TAG_BIT_D   = 1.0/T_READER_FREQ * pow(10,6); // Duration in us
     const int RN16_D        = (RN16_BITS + TAG_PREAMBLE_BITS) * TAG_BIT_D;
     const int EPC_D          = (EPC_BITS  + TAG_PREAMBLE_BITS) * TAG_BIT_D;
+    const int CW_LEAD_D      = 200;     // CW queued ahead while the length of a reply is unknown (us)
     // Query command 
     const int QUERY_CODE[4] = {1,0,0,0};
-    const int M[2]          = {0,0};
+    const int QUERY_M       = 0;        // Miller subcarrier (M field), constant for the precomputed Query words
+    const int QUERY_SESSION = 0;        // Session (S0-S3)
+    const int M[2]          = {QUERY_M >> 1, QUERY_M & 1};
     const int SEL[2]         = {0,0};
-    const int SESSION[2]     = {0,0};
+    const int SESSION[2]     = {QUERY_SESSION >> 1, QUERY_SESSION & 1};
     const int TARGET         = 0;
     const int TREXT         = 0;
     const int DR            = 0;
@@ -123,9 +252,30 @@ namespace gr {
 
     const int NAK_CODE[8]   = {1,1,0,0,0,0,0,0};
 
+    // Select command (population filtering)
+    const bool SELECT_FILTER           = false;  // Keep inventoried Tags out of the next rounds (needs QUERY_SESSION S2/S3)
+    const int  SELECT_REFRESH_ROUNDS   = 50;     // One Select (~45 bits + T4) every SELECT_REFRESH_ROUNDS moves all Tags back to the Query target
+    const int  SELECT_CW_D             = 2 * RTCAL_D; // T4 after a Select, shorter than T1 so that the gate stays closed
+
     // ACK command
     const int ACK_CODE[2]   = {0,1};
 
+    // Access phase : after a correct EPC the Tag stays singulated, a handle is requested with
+    // Req_RN and the memory regions of ACCESS_OPS are read without a new Query/ACK
+    const bool ACCESS_READ      = false;
+    const int  N_ACCESS_OPS     = 2;
+    // Memory bank (0 Reserved, 1 EPC, 2 TID, 3 User), word pointer, word count
+    const int  ACCESS_OPS[N_ACCESS_OPS][3] = { {2, 0, 6}, {3, 0, 2} };
+    const int  ACCESS_MAX_WORDS = 8;                 // Longest read, sizes the gate window and the CW
+    const int  HANDLE_BITS      = 33;                // Handle + CRC16 + Dummy
+    const int  READ_REPLY_BITS  = 1 + 16 + 16 + 1;   // Header + Handle + CRC16 + Dummy, plus 16 bits per word
+
+    // Words read by an entry of ACCESS_OPS (a word count of 0, whole bank, is not supported)
+    inline int access_read_words(int op)
+    {
+      return std::max(1, std::min(ACCESS_OPS[op][2], ACCESS_MAX_WORDS));
+    }
+
     // QueryAdjust command
     const int QADJ_CODE[4]   = {1,0,0,1};
 
@@ -139,12 +289,46 @@ namespace gr {
     const float THRESH_FRACTION = 0.75;     
     const int WIN_SIZE_D         = 250; 
 
+    // Adaptive gate : carrier level and noise floor are tracked separately and edges are
+    // detected with hysteresis at fractions of the carrier - noise swing
+    const bool  ADAPTIVE_GATE       = false;  // Fixed threshold gate until validated on captures
+    const float GATE_FALL_FRACTION  = 0.6;    // Positive -> negative edge below noise + 0.6 * swing
+    const float GATE_RISE_FRACTION  = 0.8;    // Negative -> positive edge above noise + 0.8 * swing
+    const float GATE_LEVEL_ALPHA    = 0.01;   // Smoothing factor of the carrier/noise level trackers
+    // Count only pulses whose widths match the PIE symbols sent by the reader (PW low, data-0/data-1/RTcal/TRcal high)
+    const bool  GATE_PIE_TEMPLATE   = false;
+    const float GATE_PW_TOLERANCE   = 0.5;    // Allowed width error as a fraction of PW
+    // Speculative empty slots : the gate closes an RN16 window after GATE_EMPTY_BITS if its energy
+    // is below GATE_EMPTY_SNR times the noise of the CW, and the reader only queues CW up to
+    // that point (then CW_LEAD_D ahead) so that the next QueryRep follows right away
+    const bool  SPECULATIVE_EMPTY   = false;
+    const int   GATE_EMPTY_BITS     = TAG_PREAMBLE_BITS;
+    const float GATE_EMPTY_SNR      = 2.0;
+    // The gate demodulates the PIE commands of the TX leakage, checks them against the commands
+    // sent by the reader and picks the reply window from the command (otherwise from the reader's
+    // gate_status and the pulse count). A sent command that does not show up within its duration
+    // plus COMMAND_LOST_D is lost, the decoder gets an empty window so that the reader moves on.
+    const bool  GATE_COMMAND_DECODER = false;
+    const int   COMMAND_LOST_D       = 10000;   // TX -> RX latency of the front end (us)
+
     // Duration in which dc offset is estimated (T1_D is 250)
     const int DC_SIZE_D         = 120;
 
+    // Channel tracking
+    const float CHANNEL_TRACK_MU  = 0.05;   // Step size of decision-directed h_est update
+    const float CHANNEL_AVG_ALPHA = 0.1;    // Smoothing factor of the per Tag channel cache
+
+    // Collision recovery (experimental). Two RN16 replies in the same slot are separated
+    // with successive interference cancellation and the strongest Tag is acknowledged.
+    const bool  COLLISION_RECOVERY        = false;
+    const float COLLISION_RESIDUAL_THRESH = 0.4;  // Residual/total energy above which a slot is considered collided
+    const int   SIC_ITERATIONS            = 2;
+
     // Global variable
     extern READER_STATE * reader_state;
     extern void initialize_reader_state();
+    // Frees the state once the blocks of a flowgraph are destroyed (journal synced)
+    extern void release_reader_state();
 
   } // namespace rfid
 } // namespace gr
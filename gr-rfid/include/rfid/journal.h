@@ -0,0 +1,174 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_JOURNAL_H
+#define INCLUDED_RFID_JOURNAL_H
+
+#include <rfid/api.h>
+#include <rfid/epc_bits.h>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace gr {
+  namespace rfid {
+
+    /*
+     * Journal file layout (native byte order) :
+     *
+     *   [0, JOURNAL_HEADER_SIZE)  journal_header, rewritten after each group commit
+     *   [JOURNAL_HEADER_SIZE, ..) journal_record[n_records], followed by preallocated space
+     *
+     * Records are only counted once they are on disk, a crash loses at most the records
+     * of the last commit period and never leaves a partial record inside n_records.
+     */
+    const int JOURNAL_HEADER_SIZE   = 4096;
+    const int JOURNAL_INDEX_ENTRIES = 500;
+    const int JOURNAL_VERSION       = 1;
+    const int JOURNAL_QUEUE_RECORDS = 8192;    // Records buffered between two commits
+    const int JOURNAL_GROW_RECORDS  = 65536;   // File is extended by this many records
+
+    enum JOURNAL_RECORD_TYPE {JOURNAL_EPC = 1, JOURNAL_MEM = 2};
+
+    struct journal_record
+    {
+      uint64_t time_us;     // RX time of the reply (us since the epoch)
+      uint32_t seq;
+      uint32_t ref;         // JOURNAL_MEM : seq of the EPC record of the singulated Tag
+      uint8_t  type;
+      uint8_t  antenna;
+      uint8_t  op;          // JOURNAL_MEM : index in ACCESS_OPS
+      uint8_t  reserved;
+      uint16_t n_bits;
+      uint16_t reserved2;
+      float    ampl, phase; // Channel estimate of the reply
+      uint8_t  data[EPC_MAX_BITS / 8];   // EPC or memory words, MSB first
+      uint32_t count;       // Reads merged into this record by compaction
+      uint32_t check;       // FNV-1a of the preceding bytes
+
+      void set_bits(const epc_bits & bits);
+      epc_bits bits() const;
+      uint32_t checksum() const;
+    };
+
+    struct journal_header
+    {
+      char     magic[8];
+      uint32_t version;
+      uint32_t record_size;
+      uint64_t created_us;
+      uint64_t n_records;       // Committed records
+      uint32_t index_stride;    // Records between two index entries
+      uint32_t n_index;
+      uint64_t index[JOURNAL_INDEX_ENTRIES];  // time_us of records 0, stride, 2 * stride, ...
+    };
+
+    /*!
+     * \brief Append-only journal of read events with group commit.
+     *
+     * append() copies the record into a lock-free queue and never blocks, it is called
+     * from the decoder only (single producer). A writer thread drains the queue every
+     * commit period into the memory-mapped file, syncs the records and then the header.
+     * Records are dropped and counted if the queue overflows.
+     */
+    class RFID_API journal_writer
+    {
+      public:
+        journal_writer(const std::string & path, int commit_ms);
+        ~journal_writer();
+
+        bool is_open() const { return d_open; }
+
+        // Sets seq and check (time_us to the wall clock if 0), returns false if the record was dropped
+        bool append(journal_record & record);
+        // Blocks until all the appended records are committed (or lost)
+        void sync();
+
+        uint64_t n_committed() const { return d_committed.load(boost::memory_order_relaxed); }
+        uint64_t n_dropped() const { return d_dropped.load(boost::memory_order_relaxed); }
+
+      private:
+        bool d_open;
+        int d_fd;
+        char * d_map;            // Only used by the writer thread once open
+        uint64_t d_capacity;     // Records that fit in the mapping
+        int d_commit_ms;
+        uint32_t d_seq;
+
+        boost::lockfree::spsc_queue<journal_record, boost::lockfree::capacity<JOURNAL_QUEUE_RECORDS> > d_queue;
+        boost::atomic<uint64_t> d_appended, d_processed, d_committed, d_dropped;
+        boost::atomic<bool> d_stop;
+        boost::thread d_thread;
+
+        journal_header * header() { return (journal_header *) d_map; }
+        bool map(uint64_t capacity);
+        void commit();
+        void run();
+    };
+
+    /*!
+     * \brief Read-only view of a journal file.
+     */
+    class RFID_API journal_reader
+    {
+      public:
+        journal_reader();
+        ~journal_reader();
+
+        bool open(const std::string & path);
+        void close();
+
+        const journal_header & header() const { return *(const journal_header *) d_map; }
+        uint64_t size() const { return d_n_records; }
+        const journal_record & operator[](uint64_t i) const;
+
+        // First record with time_us >= time_us (sparse index, then binary search)
+        uint64_t seek(uint64_t time_us) const;
+
+      private:
+        int d_fd;
+        const char * d_map;
+        size_t d_map_size;
+        uint64_t d_n_records;
+    };
+
+    struct journal_compact_stats
+    {
+      uint64_t n_in, n_out, n_corrupt, n_merged;
+    };
+
+    /*!
+     * \brief Copies the valid records of a journal into a new, exactly sized journal.
+     *
+     * Records with a wrong checksum are skipped. With window_us > 0, EPC reads of the same
+     * Tag and antenna less than window_us after the previous kept read are merged into it
+     * (count is incremented, the amplitude averaged and the latest phase kept). Memory
+     * records are always kept.
+     */
+    RFID_API bool journal_compact(const std::string & in, const std::string & out, uint64_t window_us,
+                                  journal_compact_stats & stats);
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_JOURNAL_H */
@@ -23,6 +23,7 @@
 
 #include <rfid/api.h>
 #include <gnuradio/block.h>
+#include <string>
 
 namespace gr {
   namespace rfid {
@@ -40,6 +41,8 @@ namespace gr {
      public:
       typedef boost::shared_ptr<reader> sptr;
       virtual void print_results() =0;
+      // Text printed by print_results()
+      virtual std::string results() =0;
       /*!
        * \brief Return a shared_ptr to a new instance of rfid::reader.
        *
@@ -48,7 +51,7 @@ namespace gr {
        * class. rfid::reader::make is the public interface for
        * creating new instances.
        */
-      static sptr make(int sample_rate, int dac_rate);
+      static sptr make(int sample_rate, int dac_rate, float amplitude);
 
     };
 
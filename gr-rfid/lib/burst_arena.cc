@@ -0,0 +1,64 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "burst_arena.h"
+
+namespace gr {
+  namespace rfid {
+
+    burst_arena::burst_arena(int slot_capacity)
+      : d_capacity(slot_capacity), d_samples(slot_capacity * BURST_ARENA_SLOTS), d_next(0)
+    {
+      for (int i = 0; i < BURST_ARENA_SLOTS; i++)
+      {
+        d_length[i] = 0;
+        d_time_us[i] = 0;
+        d_empty[i] = false;
+        d_busy[i] = false;
+      }
+    }
+
+    int burst_arena::acquire()
+    {
+      // Only the gate acquires slots, round robin keeps the order of the bursts
+      for (int n = 0; n < BURST_ARENA_SLOTS; n++)
+      {
+        int slot = (d_next + n) % BURST_ARENA_SLOTS;
+        if (!d_busy[slot].load(boost::memory_order_acquire))
+        {
+          d_busy[slot].store(true, boost::memory_order_relaxed);
+          d_next = (slot + 1) % BURST_ARENA_SLOTS;
+          return slot;
+        }
+      }
+      return -1;
+    }
+
+    void burst_arena::release(int slot)
+    {
+      d_busy[slot].store(false, boost::memory_order_release);
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
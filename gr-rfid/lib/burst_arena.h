@@ -0,0 +1,73 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_BURST_ARENA_H
+#define INCLUDED_RFID_BURST_ARENA_H
+
+#include <gnuradio/gr_complex.h>
+#include <boost/atomic.hpp>
+#include <vector>
+
+namespace gr {
+  namespace rfid {
+
+    const int BURST_ARENA_SLOTS = 8;
+
+    /*!
+     * \brief Preallocated storage for Tag replies.
+     *
+     * The gate writes the DC-free samples of a reply into a free slot and passes the slot
+     * index downstream instead of the samples. The slot is released by the last stage that
+     * reads it.
+     */
+    class burst_arena
+    {
+      public:
+        burst_arena(int slot_capacity);
+
+        // Index of a free slot, -1 if all slots are in use
+        int acquire();
+        void release(int slot);
+
+        gr_complex * samples(int slot) { return &d_samples[slot * d_capacity]; }
+        int length(int slot) const { return d_length[slot]; }
+        void set_length(int slot, int length) { d_length[slot] = length; }
+        // RX time of the first sample of the burst (us since the epoch, see sample_clock)
+        uint64_t time_us(int slot) const { return d_time_us[slot]; }
+        void set_time(int slot, uint64_t time_us) { d_time_us[slot] = time_us; }
+        // RN16 window closed early by the gate, no Tag reply (SPECULATIVE_EMPTY)
+        bool empty(int slot) const { return d_empty[slot]; }
+        void set_empty(int slot, bool empty) { d_empty[slot] = empty; }
+        int capacity() const { return d_capacity; }
+
+      private:
+        int d_capacity;
+        std::vector<gr_complex> d_samples;
+        int d_length[BURST_ARENA_SLOTS];
+        uint64_t d_time_us[BURST_ARENA_SLOTS];
+        bool d_empty[BURST_ARENA_SLOTS];
+        boost::atomic<bool> d_busy[BURST_ARENA_SLOTS];
+        int d_next;
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_BURST_ARENA_H */
@@ -0,0 +1,203 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "burst_capture.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+namespace gr {
+  namespace rfid {
+
+    static const char * CAPTURE_OUTCOME_NAMES[] =
+    {
+      "no_reply", "empty", "rn16", "collision", "epc", "epc_fail", "handle", "handle_fail", "read", "read_fail"
+    };
+
+    burst_capture::burst_capture(const std::string & path, double sample_rate, int pre_samples, int burst_capacity,
+                                 bool failed_only, int max_bursts)
+      : d_path(path), d_sample_rate(sample_rate), d_pre_samples(std::max(pre_samples, 1)), d_failed_only(failed_only),
+        d_max_bursts(max_bursts), d_n_recorded(0), d_ring_pos(0), d_captured(0), d_dropped(0), d_stop(false),
+        d_data(NULL), d_sample_start(0)
+    {
+      d_ring.resize(d_pre_samples);
+      d_pre.resize(BURST_ARENA_SLOTS * d_pre_samples);
+      for (int s = 0; s < BURST_ARENA_SLOTS; s++)
+        d_pre_length[s] = 0;
+
+      // All the memory is allocated here, the blocks only copy samples
+      d_entries.resize(CAPTURE_QUEUE_ENTRIES);
+      for (int e = 0; e < CAPTURE_QUEUE_ENTRIES; e++)
+      {
+        d_entries[e].samples.resize(d_pre_samples + burst_capacity);
+        d_free.push(e);
+      }
+
+      d_data = fopen((d_path + ".sigmf-data").c_str(), "wb");
+      if (d_data == NULL)
+        return;
+      write_meta();
+      d_thread = boost::thread(&burst_capture::run, this);
+    }
+
+    burst_capture::~burst_capture()
+    {
+      if (d_data != NULL)
+      {
+        d_stop = true;
+        d_thread.join();
+        fclose(d_data);
+      }
+    }
+
+    void burst_capture::history(const gr_complex * in, int n)
+    {
+      if (n >= d_pre_samples)
+      {
+        memcpy(&d_ring[0], &in[n - d_pre_samples], sizeof(gr_complex) * d_pre_samples);
+        d_ring_pos = 0;
+        return;
+      }
+
+      int first = std::min(n, d_pre_samples - d_ring_pos);
+      memcpy(&d_ring[d_ring_pos], in, sizeof(gr_complex) * first);
+      memcpy(&d_ring[0], &in[first], sizeof(gr_complex) * (n - first));
+      d_ring_pos = (d_ring_pos + n) % d_pre_samples;
+    }
+
+    void burst_capture::trigger(int slot, const gr_complex * in, int index)
+    {
+      gr_complex * pre = &d_pre[slot * d_pre_samples];
+
+      // Oldest samples from the ring (in order), the rest from the current input
+      int n_in   = std::min(index, d_pre_samples);
+      int n_ring = d_pre_samples - n_in;
+      int start  = (d_ring_pos - n_ring + d_pre_samples) % d_pre_samples;
+      int first  = std::min(n_ring, d_pre_samples - start);
+
+      memcpy(pre, &d_ring[start], sizeof(gr_complex) * first);
+      memcpy(pre + first, &d_ring[0], sizeof(gr_complex) * (n_ring - first));
+      memcpy(pre + n_ring, &in[index - n_in], sizeof(gr_complex) * n_in);
+      d_pre_length[slot] = d_pre_samples;
+    }
+
+    bool burst_capture::wanted(CAPTURE_OUTCOME outcome) const
+    {
+      if (d_data == NULL || d_n_recorded.load(boost::memory_order_relaxed) >= d_max_bursts)
+        return false;
+      if (!d_failed_only)
+        return true;
+      return outcome == CAPTURE_COLLISION || outcome == CAPTURE_EPC_FAIL || outcome == CAPTURE_HANDLE_FAIL ||
+             outcome == CAPTURE_READ_FAIL;
+    }
+
+    void burst_capture::record(int slot, const gr_complex * burst, int n, const capture_meta & meta)
+    {
+      int e;
+      if (!d_free.pop(e))
+      {
+        d_dropped.fetch_add(1, boost::memory_order_relaxed);
+        return;
+      }
+
+      entry & ent = d_entries[e];
+      ent.n_pre = d_pre_length[slot];
+      ent.n     = std::min<int>(n, ent.samples.size() - ent.n_pre);
+      ent.meta  = meta;
+      memcpy(&ent.samples[0], &d_pre[slot * d_pre_samples], sizeof(gr_complex) * ent.n_pre);
+      memcpy(&ent.samples[ent.n_pre], burst, sizeof(gr_complex) * ent.n);
+
+      d_full.push(e);
+      d_n_recorded.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    void burst_capture::write(const entry & e)
+    {
+      int n = e.n_pre + e.n;
+      if (fwrite(&e.samples[0], sizeof(gr_complex), n, d_data) != (size_t) n)
+        return;
+
+      std::ostringstream capture, annotation;
+      capture << (d_captures.empty() ? "" : ",\n") << "    {\"core:sample_start\": " << d_sample_start
+              << ", \"rfid:time_us\": " << e.meta.time_us << "}";
+      annotation << (d_annotations.empty() ? "" : ",\n") << "    {\"core:sample_start\": " << d_sample_start
+                 << ", \"core:sample_count\": " << n
+                 << ", \"core:label\": \"" << CAPTURE_OUTCOME_NAMES[e.meta.outcome] << "\""
+                 << ", \"rfid:pre_trigger\": " << e.n_pre
+                 << ", \"rfid:round\": " << e.meta.round << ", \"rfid:slot\": " << e.meta.slot
+                 << ", \"rfid:h_est\": [" << e.meta.h_est.real() << ", " << e.meta.h_est.imag() << "]"
+                 << ", \"rfid:t_est\": " << e.meta.t_est << "}";
+      d_captures    += capture.str();
+      d_annotations += annotation.str();
+      d_sample_start += n;
+      d_captured.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    void burst_capture::write_meta()
+    {
+      // Rewritten and renamed, so that the metadata always matches complete data
+      std::string meta = d_path + ".sigmf-meta", tmp = meta + ".tmp";
+      FILE * f = fopen(tmp.c_str(), "w");
+      if (f == NULL)
+        return;
+
+      std::ostringstream out;
+      out << "{\n  \"global\": {\"core:datatype\": \"cf32_le\", \"core:sample_rate\": " << d_sample_rate
+          << ", \"core:version\": \"1.0.0\", \"core:recorder\": \"gr-rfid\""
+          << ", \"core:description\": \"Tag reply windows, " << d_pre_samples << " pre-trigger samples each\"},\n"
+          << "  \"captures\": [\n" << d_captures << "\n  ],\n"
+          << "  \"annotations\": [\n" << d_annotations << "\n  ]\n}\n";
+      std::string text = out.str();
+
+      bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+      ok = (fclose(f) == 0) && ok;
+      if (ok)
+        rename(tmp.c_str(), meta.c_str());
+    }
+
+    void burst_capture::run()
+    {
+      bool stop = false;
+      while (!stop)
+      {
+        stop = d_stop;
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+        int e, n = 0;
+        while (d_full.pop(e))
+        {
+          write(d_entries[e]);
+          d_free.push(e);
+          n++;
+        }
+        if (n > 0)
+        {
+          fflush(d_data);
+          write_meta();
+        }
+      }
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
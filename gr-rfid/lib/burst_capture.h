@@ -0,0 +1,125 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_BURST_CAPTURE_H
+#define INCLUDED_RFID_BURST_CAPTURE_H
+
+#include "burst_arena.h"
+#include <gnuradio/gr_complex.h>
+#include <boost/lockfree/queue.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace gr {
+  namespace rfid {
+
+    const int CAPTURE_QUEUE_ENTRIES = 16;   // Bursts waiting to be written
+
+    enum CAPTURE_OUTCOME
+    {
+      CAPTURE_NO_REPLY, CAPTURE_EMPTY, CAPTURE_RN16, CAPTURE_COLLISION,
+      CAPTURE_EPC, CAPTURE_EPC_FAIL, CAPTURE_HANDLE, CAPTURE_HANDLE_FAIL, CAPTURE_READ, CAPTURE_READ_FAIL
+    };
+
+    struct capture_meta
+    {
+      CAPTURE_OUTCOME outcome;
+      int        round, slot;
+      gr_complex h_est;
+      float      t_est;      // Estimated Tag half bit (samples)
+      uint64_t   time_us;    // RX time of the burst (us since the epoch)
+    };
+
+    /*!
+     * \brief Triggered IQ capture of Tag reply windows (SigMF cf32_le recording).
+     *
+     * The gate keeps the last pre_samples input samples in a ring and snapshots them into
+     * the arena slot's pre-trigger buffer when it opens. Once the decoder knows the outcome
+     * it hands the pre-trigger samples and the burst to a writer thread through a fixed pool
+     * of entries, a burst is dropped if the pool is exhausted. Each burst is a capture segment
+     * and an annotation with the decode metadata in PATH.sigmf-meta, samples are appended to
+     * PATH.sigmf-data.
+     *
+     * record() may be called from the decoder and from its EPC worker, the entry queues
+     * are multi-producer.
+     */
+    class burst_capture
+    {
+      public:
+        burst_capture(const std::string & path, double sample_rate, int pre_samples, int burst_capacity,
+                      bool failed_only, int max_bursts);
+        ~burst_capture();
+
+        bool is_open() const { return d_data != NULL; }
+
+        // GATE : samples consumed by the gate, and snapshot when the gate opens at in[index]
+        void history(const gr_complex * in, int n);
+        void trigger(int slot, const gr_complex * in, int index);
+
+        // DECODER
+        bool wanted(CAPTURE_OUTCOME outcome) const;
+        void record(int slot, const gr_complex * burst, int n, const capture_meta & meta);
+
+        uint64_t n_captured() const { return d_captured.load(boost::memory_order_relaxed); }
+        uint64_t n_dropped() const { return d_dropped.load(boost::memory_order_relaxed); }
+
+      private:
+        struct entry
+        {
+          std::vector<gr_complex> samples;   // Pre-trigger samples followed by the burst
+          int n_pre, n;
+          capture_meta meta;
+        };
+
+        std::string d_path;
+        double d_sample_rate;
+        int d_pre_samples;
+        bool d_failed_only;
+        int d_max_bursts;
+        boost::atomic<int> d_n_recorded;     // Handed to the writer
+
+        std::vector<gr_complex> d_ring;
+        int d_ring_pos;
+        std::vector<gr_complex> d_pre;       // BURST_ARENA_SLOTS x pre_samples
+        int d_pre_length[BURST_ARENA_SLOTS];
+
+        std::vector<entry> d_entries;
+        boost::lockfree::queue<int, boost::lockfree::capacity<CAPTURE_QUEUE_ENTRIES> > d_full, d_free;
+        boost::atomic<uint64_t> d_captured, d_dropped;
+        boost::atomic<bool> d_stop;
+        boost::thread d_thread;
+
+        // Writer thread
+        FILE * d_data;
+        uint64_t d_sample_start;
+        std::string d_captures, d_annotations;   // JSON array elements
+        void write(const entry & e);
+        void write_meta();
+        void run();
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_BURST_CAPTURE_H */
@@ -0,0 +1,81 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "command_log.h"
+
+namespace gr {
+  namespace rfid {
+
+    command_log::command_log()
+      : d_head(0), d_count(0)
+    {
+    }
+
+    bool command_log::sent(const gen2_bits & bits, bool preamble, int duration_us)
+    {
+      sent_command cmd;
+      cmd.bits        = bits;
+      cmd.preamble    = preamble;
+      cmd.duration_us = duration_us;
+      return d_queue.push(cmd);
+    }
+
+    void command_log::drain()
+    {
+      while (d_count < COMMAND_LOG_ENTRIES && d_queue.pop(d_ring[(d_head + d_count) % COMMAND_LOG_ENTRIES]))
+        d_count++;
+    }
+
+    const sent_command * command_log::pending()
+    {
+      drain();
+      return d_count > 0 ? &d_ring[d_head] : NULL;
+    }
+
+    int command_log::match(const gen2_bits & bits, bool preamble)
+    {
+      drain();
+      for (int k = 0; k < d_count; k++)
+      {
+        const sent_command & cmd = d_ring[(d_head + k) % COMMAND_LOG_ENTRIES];
+        if (cmd.preamble == preamble && cmd.bits == bits)
+        {
+          d_head   = (d_head + k + 1) % COMMAND_LOG_ENTRIES;
+          d_count -= k + 1;
+          return k;
+        }
+      }
+      return -1;
+    }
+
+    void command_log::drop()
+    {
+      if (d_count == 0)
+        return;
+      d_head = (d_head + 1) % COMMAND_LOG_ENTRIES;
+      d_count--;
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,74 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_COMMAND_LOG_H
+#define INCLUDED_RFID_COMMAND_LOG_H
+
+#include "gen2_commands.h"
+#include <boost/lockfree/spsc_queue.hpp>
+
+namespace gr {
+  namespace rfid {
+
+    const int COMMAND_LOG_ENTRIES = 16;   // Commands sent and not yet seen by the gate
+
+    struct sent_command
+    {
+      gen2_bits bits;
+      bool      preamble;
+      int       duration_us;   // PIE waveform of the command
+    };
+
+    /*!
+     * \brief Commands transmitted by the reader, in order, for the gate to check the commands
+     * it demodulates from the TX leakage against them.
+     *
+     * sent() is only called by the reader, the other members only by the gate (single
+     * producer, single consumer). The gate moves the commands out of the queue into a fixed
+     * ring, so that later commands can be matched without dropping the earlier ones.
+     */
+    class command_log
+    {
+      public:
+        command_log();
+
+        // READER
+        bool sent(const gen2_bits & bits, bool preamble, int duration_us);
+
+        // GATE : oldest command that was not seen yet, NULL if none
+        const sent_command * pending();
+        // Removes the pending commands up to the one with these bits. Returns the number of
+        // commands before it (lost), -1 if none matches
+        int match(const gen2_bits & bits, bool preamble);
+        // Removes the oldest pending command (lost)
+        void drop();
+
+      private:
+        boost::lockfree::spsc_queue<sent_command, boost::lockfree::capacity<COMMAND_LOG_ENTRIES> > d_queue;
+        sent_command d_ring[COMMAND_LOG_ENTRIES];
+        int d_head, d_count;
+
+        void drain();
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_COMMAND_LOG_H */
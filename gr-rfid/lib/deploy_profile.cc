@@ -0,0 +1,51 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "deploy_profile.h"
+#include "rfid/global_vars.h"
+#include <sys/mman.h>
+
+namespace gr {
+  namespace rfid {
+
+    void deploy_block(gr::block & block, DEPLOY_ROLE role, long min_items, long max_items)
+    {
+      if (DEPLOY_CORES[role] >= 0)
+        block.set_processor_affinity(std::vector<int>(1, DEPLOY_CORES[role]));
+      block.set_thread_priority(DEPLOY_RT_PRIORITY);
+
+      if (min_items > 0)
+        block.set_min_output_buffer(min_items);
+      if (max_items > 0)
+        block.set_max_output_buffer(max_items);
+    }
+
+    bool deploy_lock_memory()
+    {
+      // Page faults in the loop would cost more than T2
+      return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
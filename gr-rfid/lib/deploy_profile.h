@@ -0,0 +1,47 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_DEPLOY_PROFILE_H
+#define INCLUDED_RFID_DEPLOY_PROFILE_H
+
+#include <gnuradio/block.h>
+
+namespace gr {
+  namespace rfid {
+
+    // Index in DEPLOY_CORES
+    enum DEPLOY_ROLE {DEPLOY_GATE, DEPLOY_DECODER, DEPLOY_READER};
+
+    /*!
+     * \brief Applies the deployment profile (DEPLOY_PROFILE) to a block of the loop.
+     *
+     * The block is pinned to its core and its thread runs with SCHED_FIFO at
+     * DEPLOY_RT_PRIORITY once the flowgraph starts. Its output buffers hold at least
+     * min_items and at most max_items items (0 : scheduler default).
+     */
+    void deploy_block(gr::block & block, DEPLOY_ROLE role, long min_items, long max_items);
+
+    // Locks the current and future memory of the process, false without the privilege
+    bool deploy_lock_memory();
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_DEPLOY_PROFILE_H */
@@ -0,0 +1,160 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <rfid/epc_bits.h>
+#include "gen2_commands.h"
+#include <algorithm>
+#include <cstring>
+
+namespace gr {
+  namespace rfid {
+
+    void epc_bits::clear()
+    {
+      memset(d_words, 0, sizeof(d_words));
+      d_size = 0;
+    }
+
+    void epc_bits::push_back(int bit)
+    {
+      if (d_size == EPC_MAX_BITS)
+        return;
+      if (bit)
+        d_words[d_size >> 6] |= uint64_t(1) << (63 - (d_size & 63));
+      d_size++;
+    }
+
+    void epc_bits::append(uint64_t value, int n_bits)
+    {
+      for (int i = n_bits - 1; i >= 0; i--)
+        push_back((value >> i) & 1);
+    }
+
+    uint64_t epc_bits::value(int first, int n_bits) const
+    {
+      int word = first >> 6, offset = first & 63;
+
+      // Bits of the first word, then the rest from the next word
+      uint64_t v = d_words[word] << offset;
+      if (offset != 0 && word + 1 < EPC_MAX_WORDS)
+        v |= d_words[word + 1] >> (64 - offset);
+      return n_bits == 64 ? v : v >> (64 - n_bits);
+    }
+
+    epc_bits epc_bits::sub(int first, int n_bits) const
+    {
+      epc_bits bits;
+      n_bits = std::max(0, std::min(n_bits, d_size - first));
+      for (int i = 0; i < n_bits; i += 64)
+      {
+        int n = std::min(64, n_bits - i);
+        bits.append(value(first + i, n), n);
+      }
+      return bits;
+    }
+
+    int epc_bits::xpc_words() const
+    {
+      if (!(pc() & 0x200))
+        return 0;
+      if (d_size < 32)
+        return 2;
+      return 1 + (*this)[16];
+    }
+
+    epc_bits epc_bits::epc() const
+    {
+      // EPC length from the PC, limited to the bits that were received
+      int first = 16 + 16 * xpc_words();
+      return sub(first, std::min(pc_epc_bits(), d_size - first - 16));
+    }
+
+    uint16_t epc_bits::crc16(int n_bits) const
+    {
+      unsigned crc = CRC16_PRESET;
+      int i = 0;
+
+      // Whole bytes first
+      for (; i + 8 <= n_bits; i += 8)
+      {
+        crc ^= value(i, 8) << 8;
+        for (int j = 0; j < 8; j++)
+          crc = (crc & 0x8000) ? ((crc << 1) ^ CRC16_POLY) : (crc << 1);
+      }
+      for (; i < n_bits; i++)
+      {
+        unsigned feedback = (*this)[i] ^ ((crc >> 15) & 1);
+        crc = (crc << 1) ^ (feedback ? CRC16_POLY : 0);
+      }
+      return ~crc & 0xFFFF;
+    }
+
+    bool epc_bits::check_crc() const
+    {
+      if (d_size <= 16)
+        return false;
+      return crc16(d_size - 16) == value(d_size - 16, 16);
+    }
+
+    size_t epc_bits::hash() const
+    {
+      // FNV-1a over the used words and the size
+      uint64_t h = 14695981039346656037ULL;
+      for (int w = 0; w < (d_size + 63) / 64; w++)
+        h = (h ^ d_words[w]) * 1099511628211ULL;
+      h = (h ^ d_size) * 1099511628211ULL;
+      return h;
+    }
+
+    std::string epc_bits::to_hex() const
+    {
+      static const char digits[] = "0123456789abcdef";
+      std::string hex;
+      for (int i = 0; i < d_size; i += 4)
+      {
+        int n = std::min(4, d_size - i);
+        hex += digits[value(i, n) << (4 - n)];
+      }
+      return hex;
+    }
+
+    bool epc_bits::operator==(const epc_bits & other) const
+    {
+      return d_size == other.d_size && memcmp(d_words, other.d_words, sizeof(d_words)) == 0;
+    }
+
+    bool epc_bits::operator<(const epc_bits & other) const
+    {
+      if (d_size != other.d_size)
+        return d_size < other.d_size;
+      for (int w = 0; w < EPC_MAX_WORDS; w++)
+      {
+        if (d_words[w] != other.d_words[w])
+          return d_words[w] < other.d_words[w];
+      }
+      return false;
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,142 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fm0_kernels.h"
+#include "rfid/global_vars.h"
+#include <cmath>
+
+namespace gr {
+  namespace rfid {
+
+    void fm0_kernel::resample(const gr_complex * in, int index, float T, int n, gr_complex * out)
+    {
+      int64_t step = (int64_t) (T * 65536.0 + 0.5);
+      int64_t pos  = (int64_t) index << 16;
+      for (int k = 0; k < n; k++, pos += step)
+        out[k] = in[pos >> 16];
+    }
+
+    float fm0_kernel::energy(const gr_complex * in, int index, float T, int n)
+    {
+      int64_t step = (int64_t) (T * 65536.0 + 0.5);
+      int64_t pos  = (int64_t) index << 16;
+      float energy = 0;
+      for (int k = 0; k < n; k++, pos += step)
+        energy += std::norm(in[pos >> 16]);
+      return energy;
+    }
+
+    epc_bits fm0_kernel::decode_header(const gr_complex * in, int size, int n_bits) const
+    {
+      epc_bits bits;
+
+      // Preamble within 1.5 bit of the start of the burst, as in the decoder
+      int n_candidates = (int) std::ceil(3 * d_half_bit);
+      if (n_candidates + (int) (11 * d_half_bit) >= size)
+        return bits;
+      std::vector<gr_complex> corr(n_candidates);
+      preamble(in, n_candidates, &corr[0]);
+
+      int best = 0;
+      for (int i = 1; i < n_candidates; i++)
+      {
+        if (std::norm(corr[i]) > std::norm(corr[best]))
+          best = i;
+      }
+      gr_complex h = corr[best] / float(6);
+
+      std::vector<gr_complex> samples(2 * n_bits);
+      int index = best + (int) ((2 * TAG_PREAMBLE_BITS + 1) * d_half_bit);
+      if (half_bits(in, size, index, 2 * n_bits, &samples[0]) != 2 * n_bits)
+        return bits;
+
+      // Differential decoder (FM0)
+      int prev = 1;
+      for (int j = 0; j < n_bits; j++)
+      {
+        int level = std::real((samples[2*j] - samples[2*j+1]) * std::conj(h)) > 0 ? 1 : -1;
+        bits.push_back(level == prev ? 0 : 1);
+        prev = level;
+      }
+      return bits;
+    }
+
+    fm0_kernel_generic::fm0_kernel_generic(float half_bit, int max_half_bits)
+      : fm0_kernel(half_bit)
+    {
+      for (int k = 0; k < 2 * TAG_PREAMBLE_BITS; k++)
+      {
+        if (TAG_PREAMBLE[k] == 1)
+          d_preamble.push_back((int) (k * half_bit));
+      }
+      d_half_bits.resize(max_half_bits);
+      for (int k = 0; k < max_half_bits; k++)
+        d_half_bits[k] = (int) round(k * half_bit);
+    }
+
+    void fm0_kernel_generic::preamble(const gr_complex * in, int n, gr_complex * corr) const
+    {
+      for (int i = 0; i < n; i++)
+      {
+        gr_complex sum(0,0);
+        for (int j = 0; j < d_preamble.size(); j++)
+          sum += in[i + d_preamble[j]];
+        corr[i] = sum;
+      }
+    }
+
+    int fm0_kernel_generic::half_bits(const gr_complex * in, int size, int index, int n, gr_complex * out) const
+    {
+      n = std::min<int>(n, d_half_bits.size());
+      for (int k = 0; k < n; k++)
+      {
+        if (index + d_half_bits[k] >= size)
+          return k;
+        out[k] = in[index + d_half_bits[k]];
+      }
+      return n;
+    }
+
+    template <int HALF_BIT>
+    static fm0_kernel * make_fixed(float half_bit)
+    {
+      return half_bit == HALF_BIT ? new fm0_kernel_fixed<HALF_BIT>() : NULL;
+    }
+
+    fm0_kernel * make_fm0_kernel(float half_bit, int max_half_bits)
+    {
+      // 320, 400, 640 and 800 kS/s, 1.6 and 2 MS/s at BLF 40 kHz
+      fm0_kernel * kernel = NULL;
+      if (!kernel) kernel = make_fixed<4>(half_bit);
+      if (!kernel) kernel = make_fixed<5>(half_bit);
+      if (!kernel) kernel = make_fixed<8>(half_bit);
+      if (!kernel) kernel = make_fixed<10>(half_bit);
+      if (!kernel) kernel = make_fixed<20>(half_bit);
+      if (!kernel) kernel = make_fixed<25>(half_bit);
+      if (!kernel) kernel = new fm0_kernel_generic(half_bit, max_half_bits);
+      return kernel;
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,116 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_FM0_KERNELS_H
+#define INCLUDED_RFID_FM0_KERNELS_H
+
+#include <gnuradio/gr_complex.h>
+#include <rfid/epc_bits.h>
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+namespace gr {
+  namespace rfid {
+
+    /*!
+     * \brief Sample access of the Tag decoder at multiples of the FM0 half bit.
+     *
+     * make_fm0_kernel() picks the kernel once for the sample rate. fm0_kernel_fixed is
+     * specialized on an integer number of samples per half bit (unrolled preamble correlation,
+     * constant strides), fm0_kernel_generic reads from offset tables built at construction.
+     * Neither computes float indices in its loops.
+     */
+    class fm0_kernel
+    {
+      public:
+        fm0_kernel(float half_bit) : d_half_bit(half_bit) {}
+        virtual ~fm0_kernel() {}
+
+        virtual const char * name() const = 0;
+
+        // corr[i] = sum of in[i + k * half_bit] over the preamble half bits at level 1, i in [0, n)
+        virtual void preamble(const gr_complex * in, int n, gr_complex * corr) const = 0;
+
+        // out[k] = in[index + k * half_bit] for k < n inside in[0, size), returns the number of samples
+        virtual int half_bits(const gr_complex * in, int size, int index, int n, gr_complex * out) const = 0;
+
+        // Same at the estimated (fractional) half bit T of an EPC, positions in 16.16 fixed point
+        static void resample(const gr_complex * in, int index, float T, int n, gr_complex * out);
+        static float energy(const gr_complex * in, int index, float T, int n);
+
+        // First n_bits of the reply starting in[0, size) (preamble sync, FM0 decision on the
+        // preamble channel estimate), empty if they have not all been received
+        epc_bits decode_header(const gr_complex * in, int size, int n_bits) const;
+
+      protected:
+        float d_half_bit;
+    };
+
+    template <int HALF_BIT>
+    class fm0_kernel_fixed : public fm0_kernel
+    {
+      public:
+        fm0_kernel_fixed() : fm0_kernel(HALF_BIT) {}
+
+        const char * name() const { return "fixed"; }
+
+        void preamble(const gr_complex * in, int n, gr_complex * corr) const
+        {
+          // Preamble ({1,1,0,1,0,0,1,0,0,0,1,1}) half bits 0 1 3 6 10 11
+          for (int i = 0; i < n; i++)
+            corr[i] = in[i] + in[i + HALF_BIT] + in[i + 3*HALF_BIT] + in[i + 6*HALF_BIT] + in[i + 10*HALF_BIT] + in[i + 11*HALF_BIT];
+        }
+
+        int half_bits(const gr_complex * in, int size, int index, int n, gr_complex * out) const
+        {
+          if (index >= size)
+            return 0;
+          n = std::min(n, (size - 1 - index) / HALF_BIT + 1);
+
+          const gr_complex * p = in + index;
+          for (int k = 0; k < n; k++, p += HALF_BIT)
+            out[k] = *p;
+          return n;
+        }
+    };
+
+    class fm0_kernel_generic : public fm0_kernel
+    {
+      public:
+        fm0_kernel_generic(float half_bit, int max_half_bits);
+
+        const char * name() const { return "generic"; }
+        void preamble(const gr_complex * in, int n, gr_complex * corr) const;
+        int half_bits(const gr_complex * in, int size, int index, int n, gr_complex * out) const;
+
+      private:
+        std::vector<int> d_preamble;   // Offsets of the preamble half bits at level 1
+        std::vector<int> d_half_bits;  // round(k * half_bit)
+    };
+
+    // Kernel for half_bit samples per half bit (fixed for 4, 5, 8, 10, 20 and 25), reads of up
+    // to max_half_bits half bits
+    fm0_kernel * make_fm0_kernel(float half_bit, int max_half_bits);
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_FM0_KERNELS_H */
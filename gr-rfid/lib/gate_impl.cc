@@ -24,7 +24,11 @@
 
 #include <gnuradio/io_signature.h>
 #include "gate_impl.h"
-#include <sys/time.h>
+#include "metrics.h"
+#include "burst_arena.h"
+#include "burst_capture.h"
+#include "command_log.h"
+#include "deploy_profile.h"
 
 namespace gr {
   namespace rfid {
@@ -41,14 +45,21 @@ namespace gr {
     gate_impl::gate_impl(int sample_rate)
       : gr::block("gate",
               gr::io_signature::make(1, 1, sizeof(gr_complex)),
-              gr::io_signature::make(1, 1, sizeof(gr_complex))),
-              n_samples(0), win_index(0), dc_index(0), num_pulses(0), signal_state(NEG_EDGE), avg_ampl(0), dc_est(0,0)
+              gr::io_signature::make(1, 1, sizeof(int))),
+              n_samples(0), win_index(0), dc_index(0), num_pulses(0), signal_state(NEG_EDGE), avg_ampl(0), dc_est(0,0), burst_slot(-1),
+              carrier_level(0), noise_floor(0), high_width(0), armed(false), epc_header_bits(0),
+              cw_noise(0), burst_energy(0), seek_empty(false),
+              pie(PW_D * (sample_rate / pow(10,6)), RTCAL_D * (sample_rate / pow(10,6))), command_age(0),
+              s_rate(sample_rate), rx_clock(sample_rate), rx_time_key(pmt::string_to_symbol("rx_time"))
     {
 
        n_samples_T1       = T1_D       * (sample_rate / pow(10,6));
        n_samples_PW       = PW_D       * (sample_rate / pow(10,6));
+       n_samples_TRCAL    = TRCAL_D    * (sample_rate / pow(10,6));
         n_samples_TAG_BIT = TAG_BIT_D * (sample_rate / pow(10,6));
       
+      n_samples_empty = GATE_EMPTY_BITS * n_samples_TAG_BIT;
+
       win_length = WIN_SIZE_D * (sample_rate/ pow(10,6));
       dc_length  = DC_SIZE_D  * (sample_rate / pow(10,6));
 
@@ -67,6 +78,35 @@ namespace gr {
       // First block to be scheduled
       GR_LOG_INFO(d_logger, "Initializing reader state...");
       initialize_reader_state();
+      // The gate is armed by the first Query of the reader
+      reader_state->gate_status = GATE_CLOSED;
+      reader_state->n_samples_to_ungate = (RN16_BITS + TAG_PREAMBLE_BITS) * n_samples_TAG_BIT + 2*n_samples_TAG_BIT;
+
+      if (DEPLOY_PROFILE)
+      {
+        // One item per burst arena slot
+        deploy_block(*this, DEPLOY_GATE, 0, BURST_ARENA_SLOTS);
+        if (!deploy_lock_memory())
+          GR_LOG_WARN(d_logger, "Cannot lock memory (mlockall), check the memlock limit");
+      }
+
+      // Longest Tag reply (EPC or memory read) plus margin for the timing search of the decoder
+      int burst_capacity = (std::max(EPC_MAX_REPLY_BITS, READ_REPLY_BITS + 16 * ACCESS_MAX_WORDS) + TAG_PREAMBLE_BITS + 6) * n_samples_TAG_BIT;
+      reader_state->bursts = new burst_arena(burst_capacity);
+      GR_LOG_INFO(d_logger, "Burst arena : " << BURST_ARENA_SLOTS << " slots of " << burst_capacity << " samples");
+
+      kernel = make_fm0_kernel(TAG_BIT_D * (sample_rate / pow(10,6)) / 2, 2 * EPC_HEADER_BITS);
+
+      reader_state->capture = NULL;
+      if (CAPTURE_FILE[0] != '\0')
+      {
+        reader_state->capture = new burst_capture(CAPTURE_FILE, sample_rate, CAPTURE_PRE_D * (sample_rate / pow(10,6)), burst_capacity,
+                                                  CAPTURE_FAILED_ONLY, CAPTURE_MAX_BURSTS);
+        if (!reader_state->capture->is_open())
+          GR_LOG_WARN(d_logger, "Cannot write captures to " << CAPTURE_FILE);
+      }
+
+      exporter_thread = boost::thread(&gate_impl::exporter, this);
     } 
 
     /*
@@ -74,6 +114,16 @@ namespace gr {
      */
     gate_impl::~gate_impl()
     {
+      // Wakes the exporter from its sleep
+      exporter_thread.interrupt();
+      exporter_thread.join();
+      delete kernel;
+    }
+
+    int
+    gate_impl::reply_window(int n_bits) const
+    {
+      return (n_bits + TAG_PREAMBLE_BITS) * n_samples_TAG_BIT + 2*n_samples_TAG_BIT;
     }
 
     void
@@ -82,6 +132,183 @@ namespace gr {
         ninput_items_required[0] = noutput_items;
     }
 
+    bool
+    gate_impl::pie_low_width(int width) const
+    {
+      return std::abs(width - n_samples_PW) <= GATE_PW_TOLERANCE * n_samples_PW;
+    }
+
+    bool
+    gate_impl::pie_high_width(int width) const
+    {
+      // High part of data-0, data-1, RTcal and TRcal
+      const int widths[4] = {n_samples_PW, 3 * n_samples_PW, 5 * n_samples_PW, n_samples_TRCAL - n_samples_PW};
+
+      for (int k = 0; k < 4; k++)
+      {
+        if (std::abs(width - widths[k]) <= GATE_PW_TOLERANCE * n_samples_PW)
+          return true;
+      }
+      return false;
+    }
+
+    void
+    gate_impl::arm()
+    {
+      // The reader moved on without a detected command for the previous window
+      if (armed)
+      {
+        reader_state->reader_stats.n_missed_triggers++;
+        reader_state->metrics->add(METRIC_MISSED_TRIGGERS);
+      }
+      armed = true;
+    }
+
+    void
+    gate_impl::lost_commands(int n)
+    {
+      reader_state->reader_stats.n_lost_commands += n;
+      reader_state->metrics->add(METRIC_LOST_COMMANDS, n);
+    }
+
+    bool
+    gate_impl::check_command()
+    {
+      const gen2_bits & bits = pie.bits();
+      int skipped = reader_state->commands->match(bits, pie.preamble());
+
+      // Seen twice, corrupted, or not sent by this reader : no window, the reader is not waiting for it
+      if (skipped < 0)
+      {
+        reader_state->reader_stats.n_duplicate_commands++;
+        reader_state->metrics->add(METRIC_DUPLICATE_COMMANDS);
+        GR_LOG_INFO(d_debug_logger, "UNEXPECTED READER COMMAND OF " << bits.size() << " BITS");
+        return false;
+      }
+      if (skipped > 0)
+        lost_commands(skipped);
+      command_age = 0;
+
+      // Reply window of the command
+      GEN2_COMMAND type = gen2_command_type(bits, pie.preamble());
+      GR_LOG_INFO(d_debug_logger, "READER COMMAND " << type << " DETECTED");
+      epc_header_bits = 0;
+      seek_empty = false;
+      switch (type)
+      {
+        case GEN2_QUERY:
+        case GEN2_QUERY_REP:
+        case GEN2_QUERY_ADJUST:
+          seek_empty = SPECULATIVE_EMPTY;
+          reader_state->n_samples_to_ungate = reply_window(RN16_BITS);
+          return true;
+        case GEN2_ACK:
+          // Up to the PC word, the rest once its length is known
+          epc_header_bits = 16;
+          reader_state->n_samples_to_ungate = reply_window(epc_header_bits);
+          return true;
+        case GEN2_REQ_RN:
+          reader_state->n_samples_to_ungate = reply_window(HANDLE_BITS);
+          return true;
+        case GEN2_READ:
+        {
+          // A word count of 0 (whole bank) gets the longest window
+          int n_words = gen2_read_word_count(bits);
+          n_words = (n_words > 0) ? std::min(n_words, ACCESS_MAX_WORDS) : ACCESS_MAX_WORDS;
+          reader_state->n_samples_to_ungate = reply_window(READ_REPLY_BITS + 16 * n_words);
+          return true;
+        }
+        default:
+          // NAK, Select : no Tag reply
+          return false;
+      }
+    }
+
+    bool
+    gate_impl::command_lost()
+    {
+      const sent_command * cmd = reader_state->commands->pending();
+      if (cmd == NULL)
+      {
+        command_age = 0;
+        return false;
+      }
+      if (command_age < (cmd->duration_us + T1_D + COMMAND_LOST_D) * (s_rate / pow(10,6)))
+        return false;
+
+      // True if the reader waits for the reply window of the lost command
+      bool reply = gen2_command_reply(gen2_command_type(cmd->bits, cmd->preamble));
+      GR_LOG_INFO(d_debug_logger, "READER COMMAND LOST");
+      reader_state->commands->drop();
+      lost_commands(1);
+      command_age = 0;
+      return reply;
+    }
+
+    void
+    gate_impl::update_levels(float sample_ampl)
+    {
+      float swing = carrier_level - noise_floor;
+
+      if (sample_ampl >= noise_floor + GATE_RISE_FRACTION * swing)
+        carrier_level += GATE_LEVEL_ALPHA * (sample_ampl - carrier_level);
+      else if (sample_ampl <= noise_floor + GATE_FALL_FRACTION * swing)
+        noise_floor += GATE_LEVEL_ALPHA * (sample_ampl - noise_floor);
+
+      // Low for longer than any PIE symbol : the carrier level has changed (e.g. TX leakage, power down)
+      if (signal_state == NEG_EDGE && n_samples > 4 * n_samples_PW)
+      {
+        carrier_level = sample_ampl;
+        noise_floor   = std::min(noise_floor, sample_ampl);
+      }
+    }
+
+    void
+    gate_impl::exporter()
+    {
+      for (;;)
+      {
+        boost::this_thread::sleep(boost::posix_time::microseconds(STATS_WINDOW_D));
+        report_metrics();
+      }
+    }
+
+    void
+    gate_impl::report_metrics()
+    {
+      metrics_registry & metrics = *reader_state->metrics;
+
+      if (CONTINUOUS_INVENTORY)
+      {
+        GR_LOG_INFO(d_logger, "Reads/s (1s/10s/60s) : " << metrics.rate(METRIC_EPC_CORRECT, 1) << "/" << metrics.rate(METRIC_EPC_CORRECT, 10) << "/" << metrics.rate(METRIC_EPC_CORRECT, 60)
+                              << " | Queries/s : " << metrics.rate(METRIC_QUERIES, 10)
+                              << " | CRC failures : " << metrics.ratio(METRIC_EPC_CRC_FAIL, METRIC_RN16, 10)
+                              << " | Loop latency p99 : " << metrics.latency_quantile(0.99) << " us"
+                              << " | Tracked tags : " << reader_state->reader_stats.n_unique_tags);
+      }
+
+      if (METRICS_FILE[0] != '\0' && !metrics.export_file(METRICS_FILE))
+        GR_LOG_WARN(d_logger, "Cannot write metrics to " << METRICS_FILE);
+    }
+
+    void
+    gate_impl::update_clock(int n_items)
+    {
+      // UHD time (secs, frac) of the tagged sample, sent at start and after overflows
+      std::vector<tag_t> tags;
+      get_tags_in_range(tags, 0, nitems_read(0), nitems_read(0) + n_items, rx_time_key);
+      for (size_t t = 0; t < tags.size(); t++)
+      {
+        uint64_t secs = pmt::to_uint64(pmt::tuple_ref(tags[t].value, 0));
+        double   frac = pmt::to_double(pmt::tuple_ref(tags[t].value, 1));
+        rx_clock.anchor(tags[t].offset, secs * 1000000 + uint64_t(frac * 1000000));
+      }
+
+      // Sources without time tags (files, other front ends)
+      if (!rx_clock.anchored())
+        rx_clock.anchor(nitems_read(0), metrics_registry::epoch_us());
+    }
+
     int
     gate_impl::general_work (int noutput_items,
                        gr_vector_int &ninput_items,
@@ -90,38 +317,93 @@ namespace gr {
     {
 
       const gr_complex *in = (const gr_complex *) input_items[0];
-      gr_complex *out = (gr_complex *) output_items[0];
+      int *out = (int *) output_items[0];
+      gr_complex *burst;
 
       int n_items = ninput_items[0];
       int number_samples_consumed = n_items;
       float sample_ampl = 0;
+      float fall_thresh, rise_thresh;
       int written = 0;
 
       
-      if( (reader_state-> reader_stats.n_queries_sent   > MAX_NUM_QUERIES ||
-           reader_state-> reader_stats.tag_reads.size() > NUMBER_UNIQUE_TAGS) &&  
+      update_clock(n_items);
+
+      if(!CONTINUOUS_INVENTORY &&
+          (reader_state-> reader_stats.n_queries_sent   > MAX_NUM_QUERIES ||
+           reader_state-> reader_stats.n_unique_tags    > NUMBER_UNIQUE_TAGS) &&  
            reader_state-> status != TERMINATED)
       {
         reader_state-> status = TERMINATED;
-        gettimeofday (&reader_state-> reader_stats.end, NULL);
-        std::cout << "| Execution time : " << reader_state-> reader_stats.end.tv_sec - reader_state-> reader_stats.start.tv_sec << " seconds" << std::endl;
+        reader_state-> reader_stats.end_us = metrics_registry::now_us();
+        std::cout << "| Execution time : " << (reader_state-> reader_stats.end_us - reader_state-> reader_stats.start_us) / 1e6 << " seconds" << std::endl;
         GR_LOG_INFO(d_logger, "Termination");
        }
 
-      // Gate block is controlled by the Gen2 Logic block
-      if(reader_state->gate_status == GATE_SEEK_EPC)
+      // Gate block is controlled by the Gen2 Logic block, unless it demodulates the commands itself
+      if (!GATE_COMMAND_DECODER)
       {
-        reader_state->gate_status = GATE_CLOSED;
-        reader_state->n_samples_to_ungate = (EPC_BITS + TAG_PREAMBLE_BITS) * n_samples_TAG_BIT + 2*n_samples_TAG_BIT;
-        n_samples = 0;
+        if(reader_state->gate_status == GATE_SEEK_EPC)
+        {
+          reader_state->gate_status = GATE_CLOSED;
+          // Up to the PC word, the rest once its length is known
+          epc_header_bits = 16;
+          seek_empty = false;
+          reader_state->n_samples_to_ungate = reply_window(epc_header_bits);
+          n_samples = 0;
+          arm();
+        }
+        else if (reader_state->gate_status == GATE_SEEK_RN16)
+        {
+          reader_state->gate_status = GATE_CLOSED;
+          epc_header_bits = 0;
+          seek_empty = SPECULATIVE_EMPTY;
+          reader_state->n_samples_to_ungate = (RN16_BITS + TAG_PREAMBLE_BITS) * n_samples_TAG_BIT + 2*n_samples_TAG_BIT;
+          n_samples = 0;
+          arm();
+        }
+        else if (reader_state->gate_status == GATE_SEEK_HANDLE)
+        {
+          reader_state->gate_status = GATE_CLOSED;
+          epc_header_bits = 0;
+          seek_empty = false;
+          reader_state->n_samples_to_ungate = (HANDLE_BITS + TAG_PREAMBLE_BITS) * n_samples_TAG_BIT + 2*n_samples_TAG_BIT;
+          n_samples = 0;
+          arm();
+        }
+        else if (reader_state->gate_status == GATE_SEEK_READ)
+        {
+          reader_state->gate_status = GATE_CLOSED;
+          epc_header_bits = 0;
+          seek_empty = false;
+          reader_state->n_samples_to_ungate = (READ_REPLY_BITS + 16 * access_read_words(reader_state->access.op) + TAG_PREAMBLE_BITS) * n_samples_TAG_BIT + 2*n_samples_TAG_BIT;
+          n_samples = 0;
+          arm();
+        }
       }
-      else if (reader_state->gate_status == GATE_SEEK_RN16)
+
+      // Wait until the decoder releases a slot of the burst arena
+      if (burst_slot < 0)
+        burst_slot = reader_state->bursts->acquire();
+      if (burst_slot < 0)
       {
-        reader_state->gate_status = GATE_CLOSED;
-        reader_state->n_samples_to_ungate = (RN16_BITS + TAG_PREAMBLE_BITS) * n_samples_TAG_BIT + 2*n_samples_TAG_BIT;
-        n_samples = 0;
+        consume_each (0);
+        return 0;
       }
-      
+      burst = reader_state->bursts->samples(burst_slot);
+
+      // The reader waits for the reply to a command that never showed up in the RX samples
+      if (GATE_COMMAND_DECODER && reader_state->gate_status != GATE_OPEN && !armed && command_lost())
+      {
+        reader_state->bursts->set_length(burst_slot, 0);
+        reader_state->bursts->set_empty(burst_slot, false);
+        reader_state->bursts->set_time(burst_slot, rx_clock.time_us(nitems_read(0)));
+        out[0] = burst_slot;
+        burst_slot = -1;
+        consume_each (0);
+        return 1;
+      }
+
       if (reader_state->status == RUNNING)
       {
         for(int i = 0; i < n_items; i++)
@@ -144,57 +426,149 @@ namespace gr {
           
             n_samples++;
 
+            // Noise reference once the DC estimate only covers carrier
+            if (SPECULATIVE_EMPTY && signal_state == POS_EDGE && n_samples > dc_length)
+              cw_noise += GATE_LEVEL_ALPHA * (std::norm(in[i] - dc_est) - cw_noise);
+
+            if (ADAPTIVE_GATE)
+            {
+              update_levels(sample_ampl);
+              fall_thresh = noise_floor + GATE_FALL_FRACTION * (carrier_level - noise_floor);
+              rise_thresh = noise_floor + GATE_RISE_FRACTION * (carrier_level - noise_floor);
+            }
+            else
+            {
+              fall_thresh = sample_thresh;
+              rise_thresh = sample_thresh;
+            }
+
             // Potitive edge -> Negative edge
-            if( sample_ampl < sample_thresh && signal_state == POS_EDGE)
+            if( sample_ampl < fall_thresh && signal_state == POS_EDGE)
             {
+              high_width = n_samples;
               n_samples = 0;
               signal_state = NEG_EDGE;
             }
             // Negative edge -> Positive edge 
-            else if (sample_ampl > sample_thresh && signal_state == NEG_EDGE)
+            else if (sample_ampl > rise_thresh && signal_state == NEG_EDGE)
             {
               signal_state = POS_EDGE;
-              if (n_samples > n_samples_PW/2)
+              if (GATE_COMMAND_DECODER)
+                pie.edge(high_width, n_samples);
+              if (GATE_PIE_TEMPLATE)
+              {
+                if (!pie_low_width(n_samples))
+                  num_pulses = 0;
+                else if (num_pulses == 0 || pie_high_width(high_width))
+                  num_pulses++;
+                else
+                  num_pulses = 1; // Start of a new command
+              }
+              else if (n_samples > n_samples_PW/2)
                 num_pulses++; 
               else
                 num_pulses = 0; 
               n_samples = 0;
             }
 
-            if(n_samples > n_samples_T1 && signal_state == POS_EDGE && num_pulses > NUM_PULSES_COMMAND)
+            // End of a command : checked against the commands sent, armed if a Tag reply follows
+            if (GATE_COMMAND_DECODER && signal_state == POS_EDGE && pie.complete(n_samples))
             {
-              GR_LOG_INFO(d_debug_logger, "READER COMMAND DETECTED");
+              armed = check_command();
+              pie.reset();
+            }
 
-              reader_state->gate_status = GATE_OPEN;
+            bool command = GATE_COMMAND_DECODER ? armed : num_pulses > NUM_PULSES_COMMAND;
+            if(n_samples > n_samples_T1 && signal_state == POS_EDGE && command)
+            {
+              num_pulses = 0; 
 
-              reader_state->magn_squared_samples.resize(0);
+              if (!armed)
+              {
+                reader_state->reader_stats.n_false_triggers++;
+                reader_state->metrics->add(METRIC_FALSE_TRIGGERS);
+                GR_LOG_INFO(d_debug_logger, "READER COMMAND DETECTED, NO TAG REPLY EXPECTED");
 
+                // Keep the gate closed, the decoder would consume the burst as the reply to the next command
+                if (ADAPTIVE_GATE)
+                  continue;
+              }
+              armed = false;
 
-              reader_state->magn_squared_samples.push_back(std::norm(in[i] - dc_est));
-              out[written] = in[i] - dc_est;  
-              written++;
+              GR_LOG_INFO(d_debug_logger, "READER COMMAND DETECTED");
+
+              reader_state->gate_status = GATE_OPEN;
+              reader_state->bursts->set_time(burst_slot, rx_clock.time_us(nitems_read(0) + i));
+              if (reader_state->capture != NULL)
+                reader_state->capture->trigger(burst_slot, in, i);
+
+              // Remove offset from complex samples
+              burst[0] = in[i] - dc_est;
+              burst_energy = std::norm(burst[0]);
 
-              num_pulses = 0; 
               n_samples =  1; // Count number of samples passed to the next block
 
             }
           }
           else
           {
+            burst[n_samples] = in[i] - dc_est; // Remove offset from complex samples
             n_samples++;
 
-            reader_state->magn_squared_samples.push_back(std::norm(in[i] - dc_est));
-            out[written] = in[i] - dc_est; // Remove offset from complex samples           
-            written++;
-            if (n_samples >= reader_state->n_samples_to_ungate)
+            // Without a Tag reply the window only holds CW noise, the reader moves on without the rest of it
+            bool empty = false;
+            if (seek_empty)
+            {
+              burst_energy += std::norm(burst[n_samples - 1]);
+              if (n_samples == n_samples_empty)
+              {
+                seek_empty = false;
+                empty = cw_noise > 0 && burst_energy < GATE_EMPTY_SNR * cw_noise * n_samples;
+              }
+            }
+
+            if (epc_header_bits > 0 && n_samples >= reader_state->n_samples_to_ungate)
+            {
+              // Length of the EPC reply from its PC word, XPC_W1 is needed too if XI is set
+              epc_bits header = kernel->decode_header(burst, n_samples, epc_header_bits);
+              if (header.size() == 16 && header.xpc_words() > 0)
+              {
+                epc_header_bits = EPC_HEADER_BITS;
+                reader_state->n_samples_to_ungate = reply_window(epc_header_bits);
+              }
+              else
+              {
+                int reply_bits = (header.size() > 0) ? std::min(header.reply_bits() + 1, EPC_MAX_REPLY_BITS) : EPC_BITS;
+                GR_LOG_INFO(d_debug_logger, "EPC REPLY OF " << reply_bits << " BITS");
+                reader_state->epc_reply_bits = reply_bits;
+                reader_state->n_samples_to_ungate = reply_window(reply_bits);
+                epc_header_bits = 0;
+              }
+            }
+
+            if (empty || n_samples >= reader_state->n_samples_to_ungate || n_samples == reader_state->bursts->capacity())
             {
               reader_state->gate_status = GATE_CLOSED;    
+              reader_state->tag_reply_end_us = metrics_registry::now_us();
+
+              // Pass the burst to the decoder
+              reader_state->bursts->set_length(burst_slot, n_samples);
+              reader_state->bursts->set_empty(burst_slot, empty);
+              out[written] = burst_slot;
+              written++;
+              burst_slot = -1;
+
               number_samples_consumed = i+1;
               break;
             }
           }
         }
       }
+      if (reader_state->capture != NULL)
+        reader_state->capture->history(in, number_samples_consumed);
+      // Samples during which the oldest pending command could have been seen
+      if (GATE_COMMAND_DECODER && reader_state->gate_status != GATE_OPEN && !armed)
+        command_age += number_samples_consumed;
       consume_each (number_samples_consumed);
       return written;
     }
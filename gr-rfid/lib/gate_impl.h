@@ -23,7 +23,11 @@
 
 #include <rfid/gate.h>
 #include <vector>
+#include <boost/thread.hpp>
 #include "rfid/global_vars.h"
+#include "fm0_kernels.h"
+#include "sample_clock.h"
+#include "gen2_commands.h"
 
 namespace gr { 
   namespace rfid {
@@ -33,16 +37,54 @@ namespace gr {
   
         enum SIGNAL_STATE {NEG_EDGE, POS_EDGE};
 
-        int   n_samples, n_samples_T1, n_samples_PW, n_samples_TAG_BIT; 
+        int   n_samples, n_samples_T1, n_samples_PW, n_samples_TRCAL, n_samples_TAG_BIT; 
         int  win_index, dc_index, win_length, dc_length, s_rate;
         float avg_ampl, num_pulses, sample_thresh;
 
         std::vector<float> win_samples,cw_samples;  
         std::vector<gr_complex> dc_samples;
         gr_complex dc_est;
+        int burst_slot;     // Slot of the burst arena that receives the next Tag reply
+
+        // Variable-length EPC : the window is extended once the PC word has been received
+        fm0_kernel * kernel;
+        int   epc_header_bits;  // Bits of the EPC reply still needed for its length (0 : known)
+        int   reply_window(int n_bits) const;
 
         SIGNAL_STATE signal_state;
 
+        // Adaptive thresholds
+        float carrier_level, noise_floor;
+        int   high_width;   // Duration of the last high interval (samples)
+        bool  armed;        // A Tag reply is expected (set by GATE_SEEK_RN16/EPC, or the decoded command)
+        bool  pie_high_width(int width) const;
+        bool  pie_low_width(int width) const;
+        void  update_levels(float sample_ampl);
+        void  arm();
+
+        // Speculative empty slots (SPECULATIVE_EMPTY)
+        float cw_noise;       // Power of the DC-free samples of steady CW
+        float burst_energy;   // Energy of the open RN16 window so far
+        bool  seek_empty;     // The open window may be closed early as empty
+        int   n_samples_empty;
+
+        // Commands demodulated from the TX leakage (GATE_COMMAND_DECODER)
+        pie_decoder pie;
+        int   command_age;    // Samples since the oldest pending command was sent
+        void  lost_commands(int n);
+        bool  check_command();
+        bool  command_lost();
+
+        // RX time of the samples, stamped on each burst
+        sample_clock rx_clock;
+        pmt::pmt_t rx_time_key;
+        void update_clock(int n_items);
+
+        // Throughput log and metrics export, off the RX path
+        boost::thread exporter_thread;
+        void exporter();
+        void report_metrics();
+
        public:
         gate_impl(int sample_rate);
         ~gate_impl();
@@ -0,0 +1,405 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gen2_commands.h"
+#include "rfid/global_vars.h"
+#include <boost/static_assert.hpp>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace gr {
+  namespace rfid {
+
+    // Query 1000 0 00 0 00 00 0 0000 has CRC-5 10000
+    BOOST_STATIC_ASSERT((gen2_query_word<0,0,0,0,0,0,0>::value == ((uint64_t(0x10000) << 5) | 0x10)));
+
+    unsigned gen2_crc5_bits(const unsigned char * bits, int n_bits)
+    {
+      unsigned crc = CRC5_PRESET;
+      for (int i = 0; i < n_bits; i++)
+      {
+        unsigned feedback = bits[i] ^ ((crc >> 4) & 1);
+        crc = (crc << 1) & 0x1F;
+        if (feedback)
+          crc ^= CRC5_POLY;
+      }
+      return crc;
+    }
+
+    unsigned gen2_crc16_bits(const unsigned char * bits, int n_bits)
+    {
+      unsigned crc = CRC16_PRESET;
+      for (int i = 0; i < n_bits; i++)
+      {
+        unsigned feedback = bits[i] ^ ((crc >> 15) & 1);
+        crc = (crc << 1) & 0xFFFF;
+        if (feedback)
+          crc ^= CRC16_POLY;
+      }
+      return (~crc) & 0xFFFF;
+    }
+
+    void gen2_bits::append(uint64_t value, int n_bits)
+    {
+      if (d_size + n_bits > GEN2_MAX_COMMAND_BITS)
+        n_bits = GEN2_MAX_COMMAND_BITS - d_size;
+
+      for (int i = n_bits - 1; i >= 0; i--)
+        d_bits[d_size++] = (value >> i) & 1;
+    }
+
+    void gen2_bits::append_bits(const gen2_bits & bits)
+    {
+      int n_bits = std::min(bits.size(), GEN2_MAX_COMMAND_BITS - d_size);
+      memcpy(&d_bits[d_size], bits.d_bits, n_bits);
+      d_size += n_bits;
+    }
+
+    void gen2_bits::append_ebv(uint32_t value)
+    {
+      // Number of 7 bit blocks, extension bit is set on all blocks but the last one
+      int n_blocks = 1;
+      while (n_blocks < 5 && (value >> (7 * n_blocks)) != 0)
+        n_blocks++;
+
+      for (int b = n_blocks - 1; b >= 0; b--)
+      {
+        append(b > 0 ? 1 : 0, 1);
+        append((value >> (7 * b)) & 0x7F, 7);
+      }
+    }
+
+    unsigned gen2_bits::crc5() const
+    {
+      return gen2_crc5_bits(d_bits, d_size);
+    }
+
+    unsigned gen2_bits::crc16() const
+    {
+      return gen2_crc16_bits(d_bits, d_size);
+    }
+
+    uint64_t gen2_bits::value(int first, int n_bits) const
+    {
+      uint64_t v = 0;
+      for (int i = first; i < first + n_bits; i++)
+        v = (v << 1) | (i < d_size ? d_bits[i] : 0);
+      return v;
+    }
+
+    bool gen2_bits::operator==(const gen2_bits & other) const
+    {
+      return d_size == other.d_size && memcmp(d_bits, other.d_bits, d_size) == 0;
+    }
+
+    void gen2_bits::append_crc5()
+    {
+      append(crc5(), 5);
+    }
+
+    void gen2_bits::append_crc16()
+    {
+      append(crc16(), 16);
+    }
+
+    void gen2_query::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0x8, 4);
+      bits.append(dr, 1);
+      bits.append(m, 2);
+      bits.append(trext, 1);
+      bits.append(sel, 2);
+      bits.append(session, 2);
+      bits.append(target, 1);
+      bits.append(q, 4);
+      bits.append_crc5();
+    }
+
+    void gen2_query_rep::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0x0, 2);
+      bits.append(session, 2);
+    }
+
+    void gen2_query_adjust::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0x9, 4);
+      bits.append(session, 2);
+      bits.append(updn, 3);
+    }
+
+    void gen2_ack::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0x1, 2);
+      bits.append(rn16, 16);
+    }
+
+    void gen2_nak::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0xC0, 8);
+    }
+
+    void gen2_req_rn::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0xC1, 8);
+      bits.append(rn, 16);
+      bits.append_crc16();
+    }
+
+    void gen2_read::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0xC2, 8);
+      bits.append(membank, 2);
+      bits.append_ebv(word_ptr);
+      bits.append(word_count, 8);
+      bits.append(handle, 16);
+      bits.append_crc16();
+    }
+
+    void gen2_select::encode(gen2_bits & bits) const
+    {
+      bits.clear();
+      bits.append(0xA, 4);
+      bits.append(target, 3);
+      bits.append(action, 3);
+      bits.append(membank, 2);
+      bits.append_ebv(pointer);
+      bits.append(mask.size(), 8);
+      bits.append_bits(mask);
+      bits.append(truncate, 1);
+      bits.append_crc16();
+    }
+
+    // CRC-16 in the last 16 bits
+    static bool crc16_ok(const gen2_bits & bits)
+    {
+      int n = bits.size() - 16;
+      return n > 0 && gen2_crc16_bits(bits.data(), n) == bits.value(n, 16);
+    }
+
+    GEN2_COMMAND gen2_command_type(const gen2_bits & bits, bool preamble)
+    {
+      int n = bits.size();
+
+      // Only a Query starts with a preamble
+      if (preamble)
+      {
+        bool query = n == QUERY_LENGTH && bits.value(0, 4) == 0x8 && gen2_crc5_bits(bits.data(), n - 5) == bits.value(n - 5, 5);
+        return query ? GEN2_QUERY : GEN2_UNKNOWN;
+      }
+
+      if (n == 4 && bits.value(0, 2) == 0x0)
+        return GEN2_QUERY_REP;
+      if (n == 18 && bits.value(0, 2) == 0x1)
+        return GEN2_ACK;
+      if (n == 9 && bits.value(0, 4) == 0x9)
+        return GEN2_QUERY_ADJUST;
+      if (n == 8 && bits.value(0, 8) == 0xC0)
+        return GEN2_NAK;
+      if (n == 40 && bits.value(0, 8) == 0xC1 && crc16_ok(bits))
+        return GEN2_REQ_RN;
+      if (bits.value(0, 8) == 0xC2 && crc16_ok(bits))
+        return GEN2_READ;
+      if (bits.value(0, 4) == 0xA && crc16_ok(bits))
+        return GEN2_SELECT;
+      return GEN2_UNKNOWN;
+    }
+
+    bool gen2_command_reply(GEN2_COMMAND type)
+    {
+      return type == GEN2_QUERY || type == GEN2_QUERY_REP || type == GEN2_QUERY_ADJUST || type == GEN2_ACK ||
+             type == GEN2_REQ_RN || type == GEN2_READ;
+    }
+
+    int gen2_read_word_count(const gen2_bits & bits)
+    {
+      // Code, MemBank, WordPtr (EBV), WordCount
+      int pos = 8 + 2;
+      while (pos < bits.size() && bits[pos] == 1)
+        pos += 8;
+      return bits.value(pos + 8, 8);
+    }
+
+    pie_encoder::pie_encoder(int dac_rate, float amplitude)
+      : d_amplitude(amplitude), d_samples_per_us(dac_rate / 1e6)
+    {
+      // Symbols start high (rising edge) and end low, the delimiter falls from the CW
+      build(PIE_DELIM,  0,              DELIM_D);
+      build(PIE_DATA_0, PW_D,           PW_D);
+      build(PIE_DATA_1, 3 * PW_D,       PW_D);
+      build(PIE_RTCAL,  RTCAL_D - PW_D, PW_D);
+      build(PIE_TRCAL,  TRCAL_D - PW_D, PW_D);
+      build(PIE_END,    PIE_EDGE_D,     0);     // Back to CW after the last symbol
+    }
+
+    void pie_encoder::build(PIE_SYMBOL s, double high_d, double low_d)
+    {
+      symbol & sym = d_symbols[s];
+      sym.length  = (high_d + low_d) * d_samples_per_us;
+      sym.max_len = ceil(sym.length) + 1;
+      sym.phases.resize(PIE_PHASES * sym.max_len);
+
+      for (int k = 0; k < PIE_PHASES; k++)
+      {
+        for (int m = 0; m < sym.max_len; m++)
+        {
+          // Center of the phase bin. Both edges start at their nominal time, so pulse widths
+          // measured between 50% points are unchanged
+          double tau = ((k + 0.5) / PIE_PHASES + m) / d_samples_per_us;
+          double level;
+          if (tau < high_d)
+            level = tau < PIE_EDGE_D ? 0.5 - 0.5 * cos(M_PI * tau / PIE_EDGE_D) : 1;
+          else
+            level = tau - high_d < PIE_EDGE_D ? 0.5 + 0.5 * cos(M_PI * (tau - high_d) / PIE_EDGE_D) : 0;
+          sym.phases[k * sym.max_len + m] = gr_complex(d_amplitude * level, 0);
+        }
+      }
+    }
+
+    int pie_encoder::put(PIE_SYMBOL s, double & t, int written, gr_complex * out) const
+    {
+      const symbol & sym = d_symbols[s];
+
+      // Offset of the first output sample from the symbol start, in [0,1)
+      double phase = written - t;
+      int k = std::min(PIE_PHASES - 1, std::max(0, int(phase * PIE_PHASES)));
+      int n = ceil(sym.length - phase);
+
+      memcpy(out, &sym.phases[k * sym.max_len], sizeof(gr_complex) * n);
+      t += sym.length;
+      return n;
+    }
+
+    int pie_encoder::render(const gen2_bits & bits, bool preamble, gr_complex * out) const
+    {
+      double t = 0;    // Start of the next symbol in (fractional) samples
+      int written = 0;
+
+      written += put(PIE_DELIM,  t, written, &out[written]);
+      written += put(PIE_DATA_0, t, written, &out[written]);
+      written += put(PIE_RTCAL,  t, written, &out[written]);
+      if (preamble)
+        written += put(PIE_TRCAL, t, written, &out[written]);
+
+      for (int i = 0; i < bits.size(); i++)
+        written += put(bits[i] ? PIE_DATA_1 : PIE_DATA_0, t, written, &out[written]);
+
+      written += put(PIE_END, t, written, &out[written]);
+      return written;
+    }
+
+    int pie_encoder::max_samples(int n_bits) const
+    {
+      return d_symbols[PIE_DELIM].max_len + d_symbols[PIE_DATA_0].max_len + d_symbols[PIE_RTCAL].max_len +
+             d_symbols[PIE_TRCAL].max_len + n_bits * d_symbols[PIE_DATA_1].max_len + d_symbols[PIE_END].max_len;
+    }
+
+    pie_decoder::pie_decoder(int pw, int rtcal)
+      : d_pw(pw), d_rtcal_nominal(rtcal)
+    {
+      reset();
+    }
+
+    void pie_decoder::reset()
+    {
+      d_state    = PIE_IDLE;
+      d_data0    = 0;
+      d_rtcal    = 0;
+      d_preamble = false;
+      d_bits.clear();
+    }
+
+    void pie_decoder::restart(int high, int low)
+    {
+      reset();
+      // Carrier then the low of a delimiter, or carrier off (TX underrun) : this edge may start data-0
+      if (high > d_rtcal_nominal || low > 2 * d_pw)
+        d_state = PIE_DATA0;
+    }
+
+    void pie_decoder::edge(int high, int low)
+    {
+      // Symbol that ends with this rising edge
+      int interval = high + low;
+
+      if (low <= 2 * d_pw)
+      {
+        switch (d_state)
+        {
+          case PIE_DATA0:
+            if (interval >= d_pw && interval <= 3 * d_pw)
+            {
+              d_data0 = interval;
+              d_state = PIE_RTCAL;
+              return;
+            }
+            break;
+
+          case PIE_RTCAL:
+            // RTcal is 2.5 to 3 Tari
+            if (interval > 2 * d_data0 && interval < 4 * d_data0)
+            {
+              d_rtcal = interval;
+              d_state = PIE_BITS;
+              return;
+            }
+            // The first pulse was not data-0 (e.g. the edge of the delimiter after a TX underrun)
+            if (interval >= d_pw && interval <= 3 * d_pw)
+            {
+              d_data0 = interval;
+              return;
+            }
+            break;
+
+          case PIE_BITS:
+            // Data-1 is at most 2 Tari, shorter than RTcal, TRcal is longer
+            if (d_bits.size() == 0 && !d_preamble && interval > d_rtcal)
+            {
+              d_preamble = true;
+              return;
+            }
+            if (interval < d_rtcal)
+            {
+              d_bits.append(2 * interval > d_rtcal, 1);
+              return;
+            }
+            break;
+
+          default:
+            break;
+        }
+      }
+      restart(high, low);
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
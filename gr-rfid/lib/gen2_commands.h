@@ -0,0 +1,269 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_GEN2_COMMANDS_H
+#define INCLUDED_RFID_GEN2_COMMANDS_H
+
+#include <rfid/api.h>
+#include <gnuradio/gr_complex.h>
+#include <stdint.h>
+#include <vector>
+
+namespace gr {
+  namespace rfid {
+
+    // Longest command that can be encoded : Select with a 5 block EBV pointer and a 255 bit mask
+    const int GEN2_MAX_COMMAND_BITS = 4 + 3 + 3 + 2 + 40 + 8 + 255 + 1 + 16;
+
+    // CRC-5  : x^5 + x^3 + 1, preset 01001
+    // CRC-16 : x^16 + x^12 + x^5 + 1, preset 0xFFFF, transmitted complemented
+    const unsigned CRC5_POLY    = 0x09;
+    const unsigned CRC5_PRESET  = 0x09;
+    const unsigned CRC16_POLY   = 0x1021;
+    const unsigned CRC16_PRESET = 0xFFFF;
+
+    /*
+     * Compile-time CRCs of the N least significant bits of BITS (MSB first).
+     * Used when all the fields of a command are constant.
+     */
+    template <uint64_t BITS, int N, unsigned CRC = CRC5_PRESET>
+    struct gen2_crc5
+    {
+      static const unsigned feedback = ((BITS >> (N-1)) & 1) ^ ((CRC >> 4) & 1);
+      static const unsigned value = gen2_crc5<BITS, N-1, (((CRC << 1) & 0x1F) ^ (feedback ? CRC5_POLY : 0))>::value;
+    };
+
+    template <uint64_t BITS, unsigned CRC>
+    struct gen2_crc5<BITS, 0, CRC>
+    {
+      static const unsigned value = CRC;
+    };
+
+    template <uint64_t BITS, int N, unsigned CRC = CRC16_PRESET>
+    struct gen2_crc16
+    {
+      static const unsigned feedback = ((BITS >> (N-1)) & 1) ^ ((CRC >> 15) & 1);
+      static const unsigned value = gen2_crc16<BITS, N-1, (((CRC << 1) & 0xFFFF) ^ (feedback ? CRC16_POLY : 0))>::value;
+    };
+
+    template <uint64_t BITS, unsigned CRC>
+    struct gen2_crc16<BITS, 0, CRC>
+    {
+      static const unsigned value = (~CRC) & 0xFFFF;
+    };
+
+    // Query with constant fields (22 bits, CRC-5 appended at compile time)
+    template <int DR_, int M_, int TREXT_, int SEL_, int SESSION_, int TARGET_, int Q_>
+    struct gen2_query_word
+    {
+      static const uint64_t payload = (uint64_t(0x8) << 13) | (DR_ << 12) | (M_ << 10) | (TREXT_ << 9) |
+                                      (SEL_ << 7) | (SESSION_ << 5) | (TARGET_ << 4) | Q_;
+      static const uint64_t value = (payload << 5) | gen2_crc5<payload, 17>::value;
+      static const int length = 22;
+    };
+
+    /*!
+     * \brief Fixed capacity bit buffer holding one encoded reader command (MSB first).
+     */
+    class gen2_bits
+    {
+      public:
+        gen2_bits() : d_size(0) {}
+
+        void clear() { d_size = 0; }
+        int size() const { return d_size; }
+        int operator[](int i) const { return d_bits[i]; }
+
+        void append(uint64_t value, int n_bits);
+        void append_bits(const gen2_bits & bits);
+        void append_ebv(uint32_t value);   // Extensible bit vector (8 bit blocks)
+
+        void append_crc5();                 // CRC-5 over the whole buffer
+        void append_crc16();                // CRC-16 over the whole buffer
+
+        const unsigned char * data() const { return d_bits; }
+        unsigned crc5() const;
+        unsigned crc16() const;
+
+        // N bits from FIRST as an integer (MSB first), 0 beyond the end
+        uint64_t value(int first, int n_bits) const;
+        bool operator==(const gen2_bits & other) const;
+
+      private:
+        unsigned char d_bits[GEN2_MAX_COMMAND_BITS];
+        int d_size;
+    };
+
+    // Bit-level CRCs over an arbitrary bit sequence
+    unsigned gen2_crc5_bits(const unsigned char * bits, int n_bits);
+    unsigned gen2_crc16_bits(const unsigned char * bits, int n_bits);
+
+    // Memory banks
+    enum GEN2_MEMBANK {MEMBANK_RESERVED = 0, MEMBANK_EPC = 1, MEMBANK_TID = 2, MEMBANK_USER = 3};
+
+    /*
+     * Reader commands. The field layout of each command is declared once in its encode().
+     */
+    struct gen2_query
+    {
+      int dr, m, trext, sel, session, target, q;
+      void encode(gen2_bits & bits) const;
+    };
+
+    struct gen2_query_rep
+    {
+      int session;
+      void encode(gen2_bits & bits) const;
+    };
+
+    struct gen2_query_adjust
+    {
+      int session;
+      int updn;          // 3 bit UpDn field (110 increment, 000 unchanged, 011 decrement)
+      void encode(gen2_bits & bits) const;
+    };
+
+    struct gen2_ack
+    {
+      uint16_t rn16;
+      void encode(gen2_bits & bits) const;
+    };
+
+    struct gen2_nak
+    {
+      void encode(gen2_bits & bits) const;
+    };
+
+    struct gen2_req_rn
+    {
+      uint16_t rn;       // RN16 or handle
+      void encode(gen2_bits & bits) const;
+    };
+
+    struct gen2_read
+    {
+      int membank;
+      uint32_t word_ptr;
+      int word_count;    // 0 reads the whole bank
+      uint16_t handle;
+      void encode(gen2_bits & bits) const;
+    };
+
+    struct gen2_select
+    {
+      int target;        // 000-011 inventoried S0-S3, 100 SL
+      int action;
+      int membank;
+      uint32_t pointer;  // Bit pointer
+      gen2_bits mask;    // Up to 255 bits
+      int truncate;
+      void encode(gen2_bits & bits) const;
+    };
+
+    // Reader commands told apart by their code (and length, CRC)
+    enum GEN2_COMMAND
+    {
+      GEN2_UNKNOWN, GEN2_QUERY, GEN2_QUERY_REP, GEN2_QUERY_ADJUST, GEN2_ACK, GEN2_NAK,
+      GEN2_REQ_RN, GEN2_READ, GEN2_SELECT
+    };
+
+    GEN2_COMMAND gen2_command_type(const gen2_bits & bits, bool preamble);
+    // Command after which the Interrogator waits for a Tag reply
+    bool gen2_command_reply(GEN2_COMMAND type);
+    // WordCount field of a Read command
+    int gen2_read_word_count(const gen2_bits & bits);
+
+    // Fractional start phases per symbol in the PIE symbol table
+    const int PIE_PHASES = 16;
+
+    /*!
+     * \brief Renders encoded commands into shaped complex PIE waveforms.
+     *
+     * Symbols (delimiter, data-0, data-1, RTcal, TRcal) have raised-cosine edges and are
+     * tabulated once for PIE_PHASES fractional start phases at the DAC rate. Symbol
+     * boundaries are kept in continuous time, so durations do not need to be a whole number
+     * of samples and commands are rendered without allocations. The amplitude is folded in.
+     */
+    class pie_encoder
+    {
+      public:
+        pie_encoder(int dac_rate, float amplitude);
+
+        // Preamble (Query) or frame-sync (all other commands) followed by the command bits
+        int render(const gen2_bits & bits, bool preamble, gr_complex * out) const;
+        int max_samples(int n_bits) const;
+
+        float samples_per_us() const { return d_samples_per_us; }
+
+      private:
+        enum PIE_SYMBOL {PIE_DELIM, PIE_DATA_0, PIE_DATA_1, PIE_RTCAL, PIE_TRCAL, PIE_END, PIE_N_SYMBOLS};
+
+        struct symbol
+        {
+          double length;                   // Samples (fractional)
+          int    max_len;                  // Samples written at most, any start phase
+          std::vector<gr_complex> phases;  // PIE_PHASES x max_len
+        };
+
+        float  d_amplitude;
+        double d_samples_per_us;
+        symbol d_symbols[PIE_N_SYMBOLS];
+
+        void build(PIE_SYMBOL s, double high_d, double low_d);
+        int put(PIE_SYMBOL s, double & t, int written, gr_complex * out) const;
+    };
+
+    /*!
+     * \brief Integer pulse-width decoder of PIE commands (e.g. the TX leakage seen by the gate).
+     *
+     * Fed with the high and low widths (samples) before each rising edge. A high longer than
+     * RTcal followed by a short low is a delimiter, the next interval between rising edges is
+     * data-0, then RTcal and, for a Query, TRcal (longer than RTcal). Bits are data-1 if
+     * their interval is longer than RTcal / 2, as in the Tag. The command is complete once the
+     * carrier stays high for longer than RTcal.
+     */
+    class pie_decoder
+    {
+      public:
+        pie_decoder(int pw, int rtcal);
+
+        void reset();
+        void edge(int high, int low);
+        bool complete(int high) const { return d_state == PIE_BITS && d_bits.size() > 0 && high > d_rtcal; }
+
+        const gen2_bits & bits() const { return d_bits; }
+        bool preamble() const { return d_preamble; }
+
+      private:
+        enum PIE_STATE {PIE_IDLE, PIE_DATA0, PIE_RTCAL, PIE_BITS};
+
+        int d_pw, d_rtcal_nominal;
+        PIE_STATE d_state;
+        int d_data0, d_rtcal;
+        bool d_preamble;
+        gen2_bits d_bits;
+
+        void restart(int high, int low);
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_GEN2_COMMANDS_H */
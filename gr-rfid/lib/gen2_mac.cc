@@ -0,0 +1,126 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gen2_mac.h"
+
+namespace gr {
+  namespace rfid {
+
+    //                                           START          RN16           NO_REPLY       EPC_OK         EPC_FAIL       HANDLE_OK      HANDLE_FAIL    READ_DONE      EPC_DEFERRED
+    const gen2_mac::MAC_ACTION gen2_mac::TRANSITIONS[NUM_MAC_STATES][NUM_MAC_EVENTS] =
+    {
+      /* MAC_IDLE        */ {ACT_NEW_ROUND, ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID},
+      /* MAC_WAIT_RN16   */ {ACT_NEW_ROUND, ACT_ACK,       ACT_NEXT_SLOT, ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID},
+      /* MAC_WAIT_EPC    */ {ACT_NEW_ROUND, ACT_INVALID,   ACT_NEXT_SLOT, ACT_EPC,       ACT_NEXT_SLOT, ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_EPC_DEFERRED},
+      /* MAC_WAIT_HANDLE */ {ACT_NEW_ROUND, ACT_INVALID,   ACT_NEXT_SLOT, ACT_INVALID,   ACT_INVALID,   ACT_READ,      ACT_NEXT_SLOT, ACT_INVALID,   ACT_INVALID},
+      /* MAC_WAIT_READ   */ {ACT_NEW_ROUND, ACT_INVALID,   ACT_NEXT_SLOT, ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_INVALID,   ACT_NEXT_READ, ACT_INVALID}
+    };
+
+    gen2_mac::gen2_mac(const gen2_mac_config & config)
+      : d_state(MAC_IDLE), d_q(config.q), d_q_round(config.q), d_slot(1), d_round(1),
+        d_target(config.target), d_session(config.session), d_access_op(0), d_n_access_ops(config.n_access_ops),
+        d_epc_round(0), d_flip_target(config.flip_target), d_round_ended(false),
+        d_n_queries(0), d_n_slots(0), d_n_epc(0), d_n_invalid(0)
+    {
+    }
+
+    MAC_COMMAND gen2_mac::handle(MAC_EVENT event)
+    {
+      d_round_ended = false;
+
+      switch (TRANSITIONS[d_state][event])
+      {
+        case ACT_NEW_ROUND:
+          return new_round();
+
+        case ACT_ACK:
+          d_state = MAC_WAIT_EPC;
+          return MAC_CMD_ACK;
+
+        case ACT_NEXT_SLOT:
+          return next_slot();
+
+        case ACT_EPC:
+          d_n_epc++;
+          d_epc_round++;
+          if (d_n_access_ops == 0)
+            return next_slot();
+          // Keep the Tag singulated for the access phase
+          d_access_op = 0;
+          d_state = MAC_WAIT_HANDLE;
+          return MAC_CMD_REQ_RN;
+
+        case ACT_EPC_DEFERRED:
+          // No access phase without a validated EPC, a Tag replied so the target is kept
+          d_epc_round++;
+          return next_slot();
+
+        case ACT_READ:
+          d_state = MAC_WAIT_READ;
+          return MAC_CMD_READ;
+
+        case ACT_NEXT_READ:
+          if (++d_access_op < d_n_access_ops)
+            return MAC_CMD_READ;
+          return next_slot();
+
+        default:
+          // Out of order event (e.g. late decoder result), the reader keeps waiting
+          d_n_invalid++;
+          return MAC_CMD_NONE;
+      }
+    }
+
+    MAC_COMMAND gen2_mac::new_round()
+    {
+      d_q_round = d_q;
+      d_slot    = 1;
+      d_epc_round = 0;
+      d_state   = MAC_WAIT_RN16;
+      d_n_queries++;
+      return MAC_CMD_QUERY;
+    }
+
+    MAC_COMMAND gen2_mac::next_slot()
+    {
+      d_n_slots++;
+      d_slot++;
+      if (d_slot <= max_slot())
+      {
+        d_state = MAC_WAIT_RN16;
+        d_n_queries++;
+        return MAC_CMD_QUERY_REP;
+      }
+
+      // All the Tags of the current target have been inventoried (persistent sessions only)
+      if (d_flip_target && d_session != 0 && d_epc_round == 0)
+        d_target = 1 - d_target;
+
+      d_round++;
+      d_round_ended = true;
+      return new_round();
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,101 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_GEN2_MAC_H
+#define INCLUDED_RFID_GEN2_MAC_H
+
+#include <stdint.h>
+
+namespace gr {
+  namespace rfid {
+
+    // What the reader waits for after its last command
+    enum MAC_STATE   {MAC_IDLE, MAC_WAIT_RN16, MAC_WAIT_EPC, MAC_WAIT_HANDLE, MAC_WAIT_READ, NUM_MAC_STATES};
+
+    // Outcome of the Tag reply window. EPC_DEFERRED : an EPC reply was received and is validated
+    // later (inventory only), it counts as a reply of the round but not as a correct EPC.
+    enum MAC_EVENT   {MAC_EV_START, MAC_EV_RN16, MAC_EV_NO_REPLY, MAC_EV_EPC_OK, MAC_EV_EPC_FAIL,
+                      MAC_EV_HANDLE_OK, MAC_EV_HANDLE_FAIL, MAC_EV_READ_DONE, MAC_EV_EPC_DEFERRED, NUM_MAC_EVENTS};
+
+    // Next reader command
+    enum MAC_COMMAND {MAC_CMD_NONE, MAC_CMD_QUERY, MAC_CMD_QUERY_REP, MAC_CMD_ACK, MAC_CMD_REQ_RN, MAC_CMD_READ};
+
+    struct gen2_mac_config
+    {
+      int  q;              // 2^q slots per round
+      int  session;
+      int  target;         // Initial inventoried flag (0 A, 1 B)
+      bool flip_target;    // Flip A/B after a round without reads (persistent sessions)
+      int  n_access_ops;   // Reads after each correct EPC (0 : no access phase)
+    };
+
+    /*!
+     * \brief Gen2 inventory/access state machine without any GNU Radio dependency.
+     *
+     * The transitions are a [state][event] table of actions. The blocks report the outcome
+     * of each Tag reply window with handle() and send the returned command, the same engine
+     * can be driven by a simulator or a unit test.
+     */
+    class gen2_mac
+    {
+      public:
+        gen2_mac(const gen2_mac_config & config);
+
+        MAC_COMMAND handle(MAC_EVENT event);
+
+        // Q of the next round (Q policies). Right after round_ended(), the Query just returned
+        // has not been sent yet and uses it too.
+        void set_q(int q) { d_q = q; if (d_round_ended) d_q_round = q; }
+
+        MAC_STATE state() const { return d_state; }
+        int q() const { return d_q; }
+        int slot() const { return d_slot; }            // 1 ... 2^q
+        int max_slot() const { return 1 << d_q_round; }
+        int round() const { return d_round; }
+        int target() const { return d_target; }
+        int session() const { return d_session; }
+        int access_op() const { return d_access_op; }
+
+        // Set by the event that closed the last slot of a round
+        bool round_ended() const { return d_round_ended; }
+
+        uint64_t n_queries() const { return d_n_queries; }     // Query + QueryRep
+        uint64_t n_slots() const { return d_n_slots; }
+        uint64_t n_epc() const { return d_n_epc; }
+        uint64_t n_invalid() const { return d_n_invalid; }     // Events not expected in the current state
+
+      private:
+        enum MAC_ACTION {ACT_INVALID, ACT_NEW_ROUND, ACT_ACK, ACT_NEXT_SLOT, ACT_EPC, ACT_EPC_DEFERRED, ACT_READ, ACT_NEXT_READ};
+        static const MAC_ACTION TRANSITIONS[NUM_MAC_STATES][NUM_MAC_EVENTS];
+
+        MAC_COMMAND new_round();
+        MAC_COMMAND next_slot();
+
+        MAC_STATE d_state;
+        int  d_q, d_q_round, d_slot, d_round, d_target, d_session, d_access_op, d_n_access_ops;
+        int  d_epc_round;      // Correct (or deferred) EPCs in the current round
+        bool d_flip_target, d_round_ended;
+        uint64_t d_n_queries, d_n_slots, d_n_epc, d_n_invalid;
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_GEN2_MAC_H */
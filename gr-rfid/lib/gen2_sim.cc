@@ -0,0 +1,354 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <rfid/gen2_sim.h>
+#include "rfid/global_vars.h"
+#include "gen2_commands.h"
+#include "gen2_mac.h"
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace gr {
+  namespace rfid {
+
+    namespace {
+
+      struct sim_tag
+      {
+        int   flag[4];        // Inventoried flag per session (0 A, 1 B)
+        double flag_time[4];  // Time at which the flag was set to B
+        int   counter;        // Slot counter
+        bool  active;         // Takes part in the current round
+        float ampl_db;
+        bool  read;
+      };
+
+      // Durations (us) of the commands and CW windows sent by the reader
+      struct sim_airtime
+      {
+        float tari, delim, rtcal, trcal;
+        float query, query_rep, ack, req_rn, read;
+        float cw_query, cw_ack, cw_handle, cw_read;
+        float epc_reply;
+
+        // PIE as rendered by pie_encoder : data-0 = Tari, data-1 = 2 Tari, RTcal = data-0 + data-1
+        float command(const gen2_bits & bits, bool preamble) const
+        {
+          float d = delim + tari + rtcal + (preamble ? trcal : 0);
+          for (int i = 0; i < bits.size(); i++)
+            d += bits[i] ? 2 * tari : tari;
+          return d;
+        }
+
+        sim_airtime(const gen2_sim_config & config)
+        {
+          gen2_bits bits;
+          tari  = config.tari_us;
+          delim = DELIM_D;
+          rtcal = 3 * tari;
+          trcal = 8e6 / config.blf_hz;    // DR = 8
+
+          gen2_query q = {DR, 0, TREXT, 0, config.session, 0, config.q};
+          q.encode(bits);
+          query = command(bits, true);
+          gen2_query_rep qr = {config.session};
+          qr.encode(bits);
+          query_rep = command(bits, false);
+          gen2_ack a = {0xFFFF};
+          a.encode(bits);
+          ack = command(bits, false);
+          gen2_req_rn r = {0xFFFF};
+          r.encode(bits);
+          req_rn = command(bits, false);
+          gen2_read rd = {MEMBANK_TID, 0, config.read_words, 0xFFFF};
+          rd.encode(bits);
+          read = command(bits, false);
+
+          // Tag replies and CW windows as in reader_impl
+          float tag_bit = 1e6 / config.blf_hz;
+          float rn16   = (RN16_BITS + TAG_PREAMBLE_BITS) * tag_bit;
+          epc_reply    = (EPC_BITS  + TAG_PREAMBLE_BITS) * tag_bit;
+          cw_query  = config.t1_us + config.t2_us + rn16;
+          cw_ack    = 3 * config.t1_us + config.t2_us + epc_reply;
+          cw_handle = config.t1_us + config.t2_us + (HANDLE_BITS + TAG_PREAMBLE_BITS) * tag_bit;
+          cw_read   = config.t1_us + config.t2_us + (READ_REPLY_BITS + 16 * config.read_words + TAG_PREAMBLE_BITS) * tag_bit;
+        }
+      };
+
+      class sim_rng
+      {
+        public:
+          sim_rng(uint32_t seed) : d_engine(seed) {}
+          float uniform() { return d_uniform(d_engine); }
+          bool  chance(float p) { return uniform() < p; }
+          int   below(int n) { return std::min(n - 1, int(uniform() * n)); }
+        private:
+          boost::mt19937 d_engine;
+          boost::uniform_01<float> d_uniform;
+      };
+    }
+
+    gen2_sim_config gen2_sim_default_config()
+    {
+      gen2_sim_config config;
+      config.n_tags            = 100;
+      config.capture_db        = 6;
+      config.rssi_spread_db    = 10;
+      config.ber               = 1e-4;
+      config.cmd_error         = 0;
+      config.tari_us           = 2 * PW_D;
+      config.blf_hz            = T_READER_FREQ;
+      config.t1_us             = T1_D;
+      config.t2_us             = T2_D;
+      config.turnaround_us     = 0;
+      config.q                 = FIXED_Q;
+      config.q_policy          = SIM_Q_FIXED;
+      config.session           = SESSION[0]*2 + SESSION[1];
+      config.flip_target       = CONTINUOUS_INVENTORY;
+      config.n_access_ops      = 0;
+      config.read_words        = 6;
+      config.s1_persistence_us = 2e6;
+      config.s0_reset          = true;
+      config.duration_us       = 10e6;
+      config.seed              = 1;
+      return config;
+    }
+
+    gen2_sim_result gen2_simulate(const gen2_sim_config & config)
+    {
+      sim_airtime air(config);
+      sim_rng rng(config.seed);
+      gen2_sim_result result = gen2_sim_result();
+      std::vector<sim_tag> tags(config.n_tags);
+      int s = config.session;
+
+      for (int i = 0; i < tags.size(); i++)
+      {
+        sim_tag & tag = tags[i];
+        std::fill(tag.flag, tag.flag + 4, 0);
+        std::fill(tag.flag_time, tag.flag_time + 4, 0);
+        tag.counter = 0;
+        tag.active  = false;
+        tag.ampl_db = rng.uniform() * config.rssi_spread_db;
+        tag.read    = false;
+      }
+
+      // Bit errors of the Tag replies
+      float p_rn16   = std::pow(1 - config.ber, RN16_BITS - 1);
+      float p_epc    = std::pow(1 - config.ber, EPC_BITS - 1);
+      float p_handle = std::pow(1 - config.ber, HANDLE_BITS - 1);
+      float p_read   = std::pow(1 - config.ber, READ_REPLY_BITS - 1 + 16 * config.read_words);
+      float p_cmd    = 1 - config.cmd_error;
+
+      gen2_mac_config mac_config;
+      mac_config.q            = config.q;
+      mac_config.session      = s;
+      mac_config.target       = 0;
+      mac_config.flip_target  = config.flip_target;
+      mac_config.n_access_ops = config.n_access_ops;
+      gen2_mac mac(mac_config);
+
+      double t = 0;
+      int replier = -1;           // Tag singulated in the current slot
+      int round_success = 0, round_collisions = 0;
+      MAC_COMMAND command = mac.handle(MAC_EV_START);
+      MAC_EVENT event;
+
+      result.first_full_read_us = -1;
+      while (t < config.duration_us)
+      {
+        event = MAC_EV_NO_REPLY;
+
+        if (command == MAC_CMD_QUERY || command == MAC_CMD_QUERY_REP)
+        {
+          if (command == MAC_CMD_QUERY)
+          {
+            t += air.query;
+            round_success = round_collisions = 0;
+
+            // Tags of the addressed target pick a slot
+            for (int i = 0; i < tags.size(); i++)
+            {
+              sim_tag & tag = tags[i];
+              if (s == 1 && tag.flag[1] == 1 && t - tag.flag_time[1] > config.s1_persistence_us)
+                tag.flag[1] = 0;
+              if (s == 0 && config.s0_reset)
+                tag.flag[0] = 0;
+              tag.active = tag.flag[s] == mac.target() && rng.chance(p_cmd);
+              tag.counter = rng.below(mac.max_slot());
+            }
+          }
+          else
+          {
+            t += air.query_rep;
+            for (int i = 0; i < tags.size(); i++)
+            {
+              if (tags[i].active && rng.chance(p_cmd))
+                tags[i].counter--;
+            }
+          }
+          t += air.cw_query + config.turnaround_us;
+          result.n_queries++;
+          result.n_slots++;
+
+          // Replies of this slot, a Tag that is not acknowledged waits for the next Query
+          int n_replies = 0, strongest = -1;
+          float second_db = -1e9;
+          for (int i = 0; i < tags.size(); i++)
+          {
+            sim_tag & tag = tags[i];
+            if (!tag.active || tag.counter != 0)
+              continue;
+            tag.active = false;
+            n_replies++;
+            if (strongest < 0 || tag.ampl_db > tags[strongest].ampl_db)
+            {
+              if (strongest >= 0)
+                second_db = std::max(second_db, tags[strongest].ampl_db);
+              strongest = i;
+            }
+            else
+              second_db = std::max(second_db, tag.ampl_db);
+          }
+
+          replier = -1;
+          if (n_replies == 0)
+            result.n_empty++;
+          else if (n_replies > 1)
+          {
+            result.n_collisions++;
+            round_collisions++;
+            if (tags[strongest].ampl_db - second_db >= config.capture_db)
+            {
+              result.n_captures++;
+              replier = strongest;
+            }
+          }
+          else
+            replier = strongest;
+
+          if (replier >= 0 && rng.chance(p_rn16))
+            event = MAC_EV_RN16;
+        }
+        else if (command == MAC_CMD_ACK)
+        {
+          t += air.ack + air.cw_ack + config.turnaround_us;
+          event = MAC_EV_EPC_FAIL;
+          if (rng.chance(p_cmd))
+          {
+            // Acknowledged Tags flip their inventoried flag
+            sim_tag & tag = tags[replier];
+            tag.flag[s] = 1 - mac.target();
+            tag.flag_time[s] = t;
+            if (rng.chance(p_epc))
+            {
+              event = MAC_EV_EPC_OK;
+              result.n_epc++;
+              round_success++;
+              if (!tag.read)
+              {
+                tag.read = true;
+                if (++result.n_unique == config.n_tags)
+                  result.first_full_read_us = t;
+              }
+            }
+          }
+          if (event == MAC_EV_EPC_FAIL)
+            result.n_epc_fail++;
+        }
+        else if (command == MAC_CMD_REQ_RN)
+        {
+          t += air.req_rn + air.cw_handle + config.turnaround_us;
+          event = rng.chance(p_cmd * p_handle) ? MAC_EV_HANDLE_OK : MAC_EV_HANDLE_FAIL;
+        }
+        else if (command == MAC_CMD_READ)
+        {
+          t += air.read + air.cw_read + config.turnaround_us;
+          if (rng.chance(p_cmd * p_read))
+            result.n_mem_reads++;
+          event = MAC_EV_READ_DONE;
+        }
+
+        command = mac.handle(event);
+
+        // Q of the next round from the collisions of this one (Schoute : 2.39 Tags per collided slot),
+        // the round also ends after the access phase of its last slot
+        if (config.q_policy == SIM_Q_ADAPTIVE && mac.round_ended())
+        {
+          float remaining = 2.39 * round_collisions;
+          mac.set_q(std::max(0, std::min(15, int(std::floor(std::log(std::max(1.0f, remaining)) / std::log(2.0f) + 0.5)))));
+        }
+      }
+
+      result.reads_per_s = result.n_epc / (t / 1e6);
+      result.airtime_efficiency = result.n_epc * air.epc_reply / t;
+      return result;
+    }
+
+    namespace {
+      void sweep_worker(const std::vector<gen2_sim_config> * configs, std::vector<gen2_sim_result> * results, boost::atomic<int> * next)
+      {
+        for (int i = (*next)++; i < configs->size(); i = (*next)++)
+          (*results)[i] = gen2_simulate((*configs)[i]);
+      }
+    }
+
+    std::vector<gen2_sim_result> gen2_sweep(const std::vector<gen2_sim_config> & configs, int n_threads)
+    {
+      std::vector<gen2_sim_result> results(configs.size());
+      boost::atomic<int> next(0);
+      boost::thread_group workers;
+
+      if (n_threads <= 0)
+        n_threads = std::max(1u, boost::thread::hardware_concurrency());
+      for (int i = 0; i < n_threads; i++)
+        workers.create_thread(boost::bind(sweep_worker, &configs, &results, &next));
+      workers.join_all();
+      return results;
+    }
+
+    void gen2_sim_csv_header(std::ostream & out)
+    {
+      out << "n_tags,tari_us,blf_hz,q,q_policy,session,flip_target,n_access_ops,capture_db,ber,cmd_error,turnaround_us,seed,"
+          << "n_queries,n_slots,n_empty,n_collisions,n_captures,n_epc,n_epc_fail,n_mem_reads,n_unique,"
+          << "reads_per_s,first_full_read_us,airtime_efficiency\n";
+    }
+
+    void gen2_sim_csv_row(std::ostream & out, const gen2_sim_config & c, const gen2_sim_result & r)
+    {
+      out << c.n_tags << "," << c.tari_us << "," << c.blf_hz << "," << c.q << "," << (c.q_policy == SIM_Q_FIXED ? "fixed" : "adaptive") << ","
+          << c.session << "," << c.flip_target << "," << c.n_access_ops << "," << c.capture_db << "," << c.ber << ","
+          << c.cmd_error << "," << c.turnaround_us << "," << c.seed << ","
+          << r.n_queries << "," << r.n_slots << "," << r.n_empty << "," << r.n_collisions << "," << r.n_captures << ","
+          << r.n_epc << "," << r.n_epc_fail << "," << r.n_mem_reads << "," << r.n_unique << ","
+          << r.reads_per_s << "," << r.first_full_read_us << "," << r.airtime_efficiency << "\n";
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
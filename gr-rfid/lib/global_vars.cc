@@ -24,6 +24,12 @@
 
 #include <gnuradio/io_signature.h>
 #include "rfid/global_vars.h"
+#include "metrics.h"
+#include "gen2_mac.h"
+#include <rfid/journal.h>
+#include "burst_arena.h"
+#include "burst_capture.h"
+#include "command_log.h"
 
 #include <iostream>
 namespace gr {
@@ -36,21 +42,70 @@ namespace gr {
       reader_state = new READER_STATE;
       reader_state-> reader_stats.n_queries_sent = 0;
       reader_state-> reader_stats.n_epc_correct = 0;
-
-      std::vector<int>  unique_tags_round;
-       std::map<int,int> tag_reads;    
+      reader_state-> reader_stats.n_unique_tags = 0;
+      reader_state-> reader_stats.n_collisions = 0;
+      reader_state-> reader_stats.n_collisions_recovered = 0;
+      reader_state-> reader_stats.n_selects_sent = 0;
+      reader_state-> reader_stats.n_false_triggers = 0;
+      reader_state-> reader_stats.n_missed_triggers = 0;
+      reader_state-> reader_stats.n_lost_commands = 0;
+      reader_state-> reader_stats.n_duplicate_commands = 0;
+      reader_state-> reader_stats.n_handles = 0;
+      reader_state-> reader_stats.n_mem_reads = 0;
+      reader_state-> reader_stats.n_mem_read_fail = 0;
+      reader_state-> access.op         = 0;
 
       reader_state-> status           = RUNNING;
       reader_state-> gen2_logic_status= START;
       reader_state-> gate_status       = GATE_SEEK_RN16;
       reader_state-> decoder_status   = DECODER_DECODE_RN16;
+      reader_state-> cur_antenna      = 0;
+      reader_state-> cur_target       = TARGET;
 
       reader_state-> reader_stats.max_slot_number = pow(2,FIXED_Q);
 
       reader_state-> reader_stats.cur_inventory_round = 1;
       reader_state-> reader_stats.cur_slot_number     = 1;
 
-      gettimeofday (&reader_state-> reader_stats.start, NULL);
+      reader_state-> reader_stats.start_us       = metrics_registry::now_us();
+      reader_state-> reader_stats.end_us         = 0;
+      reader_state-> reader_stats.epc_airtime_us = 0;
+
+      gen2_mac_config mac_config;
+      mac_config.q            = FIXED_Q;
+      mac_config.session      = SESSION[0]*2 + SESSION[1];
+      mac_config.target       = TARGET;
+      // Inventoried flags are kept when Tags are filtered (select_policy)
+      mac_config.flip_target  = CONTINUOUS_INVENTORY && !SELECT_FILTER;
+      mac_config.n_access_ops = ACCESS_READ ? N_ACCESS_OPS : 0;
+      reader_state-> mac              = new gen2_mac(mac_config);
+
+      reader_state-> metrics          = new metrics_registry;
+      reader_state-> commands         = new command_log;
+      reader_state-> tag_reply_end_us = 0;
+      reader_state-> epc_reply_bits   = 0;
+
+      reader_state-> journal          = NULL;
+      if (JOURNAL_FILE[0] != '\0')
+      {
+        reader_state-> journal = new journal_writer(JOURNAL_FILE, JOURNAL_COMMIT_MS);
+        if (!reader_state-> journal->is_open())
+          std::cerr << "Cannot open journal " << JOURNAL_FILE << std::endl;
+      }
+    }
+
+    void release_reader_state()
+    {
+      if (reader_state == NULL)
+        return;
+      delete reader_state-> journal;
+      delete reader_state-> capture;
+      delete reader_state-> bursts;
+      delete reader_state-> metrics;
+      delete reader_state-> commands;
+      delete reader_state-> mac;
+      delete reader_state;
+      reader_state = NULL;
     }
   } /* namespace rfid */
 } /* namespace gr */
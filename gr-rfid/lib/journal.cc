@@ -0,0 +1,401 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <rfid/journal.h>
+#include <boost/static_assert.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstddef>
+#include <map>
+
+namespace gr {
+  namespace rfid {
+
+    static const char JOURNAL_MAGIC[8] = {'R', 'F', 'I', 'D', 'J', 'R', 'N', 'L'};
+
+    BOOST_STATIC_ASSERT(sizeof(journal_record) == 112);
+    BOOST_STATIC_ASSERT(sizeof(journal_header) <= JOURNAL_HEADER_SIZE);
+
+    static uint64_t wall_us()
+    {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+    }
+
+    void journal_record::set_bits(const epc_bits & bits)
+    {
+      n_bits = bits.size();
+      memset(data, 0, sizeof(data));
+      for (int i = 0; i < n_bits; i += 8)
+      {
+        int n = std::min(8, n_bits - i);
+        data[i / 8] = bits.value(i, n) << (8 - n);
+      }
+    }
+
+    epc_bits journal_record::bits() const
+    {
+      epc_bits bits;
+      for (int i = 0; i < n_bits && i < EPC_MAX_BITS; i += 8)
+      {
+        int n = std::min(8, n_bits - i);
+        bits.append(data[i / 8] >> (8 - n), n);
+      }
+      return bits;
+    }
+
+    uint32_t journal_record::checksum() const
+    {
+      const uint8_t * p = (const uint8_t *) this;
+      uint32_t h = 2166136261u;
+      for (size_t i = 0; i < offsetof(journal_record, check); i++)
+        h = (h ^ p[i]) * 16777619u;
+      return h;
+    }
+
+    journal_writer::journal_writer(const std::string & path, int commit_ms)
+      : d_open(false), d_fd(-1), d_map(NULL), d_capacity(0), d_commit_ms(commit_ms), d_seq(0),
+        d_appended(0), d_processed(0), d_committed(0), d_dropped(0), d_stop(false)
+    {
+      d_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+      if (d_fd < 0)
+        return;
+
+      struct stat st;
+      fstat(d_fd, &st);
+      uint64_t capacity = st.st_size > JOURNAL_HEADER_SIZE ? (st.st_size - JOURNAL_HEADER_SIZE) / sizeof(journal_record) : 0;
+      if (!map(std::max<uint64_t>(capacity, JOURNAL_GROW_RECORDS)))
+        return;
+
+      journal_header * h = header();
+      if (memcmp(h->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0)
+      {
+        // New file
+        memset(h, 0, JOURNAL_HEADER_SIZE);
+        memcpy(h->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        h->version      = JOURNAL_VERSION;
+        h->record_size  = sizeof(journal_record);
+        h->created_us   = wall_us();
+        h->index_stride = 1;
+        msync(d_map, JOURNAL_HEADER_SIZE, MS_SYNC);
+      }
+      else if (h->version != JOURNAL_VERSION || h->record_size != sizeof(journal_record))
+      {
+        munmap(d_map, JOURNAL_HEADER_SIZE + d_capacity * sizeof(journal_record));
+        d_map = NULL;
+        return;
+      }
+      else if (h->n_records > 0)
+      {
+        // Existing journal, records after n_records were never committed and are overwritten
+        const journal_record * last = (const journal_record *) (d_map + JOURNAL_HEADER_SIZE) + h->n_records - 1;
+        d_seq = last->seq + 1;
+      }
+
+      d_open   = true;
+      d_thread = boost::thread(&journal_writer::run, this);
+    }
+
+    journal_writer::~journal_writer()
+    {
+      if (d_open)
+      {
+        d_stop = true;
+        d_thread.join();
+      }
+      if (d_map != NULL)
+        munmap(d_map, JOURNAL_HEADER_SIZE + d_capacity * sizeof(journal_record));
+      if (d_fd >= 0)
+        ::close(d_fd);
+    }
+
+    bool journal_writer::map(uint64_t capacity)
+    {
+      size_t size = JOURNAL_HEADER_SIZE + capacity * sizeof(journal_record);
+      if (ftruncate(d_fd, size) != 0)
+        return false;
+
+      // The old mapping stays valid if the new one fails
+      void * p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, d_fd, 0);
+      if (p == MAP_FAILED)
+        return false;
+      if (d_map != NULL)
+        munmap(d_map, JOURNAL_HEADER_SIZE + d_capacity * sizeof(journal_record));
+      d_map      = (char *) p;
+      d_capacity = capacity;
+      return true;
+    }
+
+    bool journal_writer::append(journal_record & record)
+    {
+      if (!d_open)
+        return false;
+
+      record.seq     = d_seq;
+      if (record.time_us == 0)
+        record.time_us = wall_us();
+      record.check   = record.checksum();
+      if (!d_queue.push(record))
+      {
+        d_dropped.fetch_add(1, boost::memory_order_relaxed);
+        return false;
+      }
+      d_seq++;
+      d_appended.fetch_add(1, boost::memory_order_release);
+      return true;
+    }
+
+    void journal_writer::sync()
+    {
+      uint64_t target = d_appended.load(boost::memory_order_acquire);
+      while (d_open && d_processed.load(boost::memory_order_acquire) < target)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    void journal_writer::commit()
+    {
+      journal_header * h = header();
+      uint64_t first = h->n_records, n = h->n_records, lost = 0;
+      journal_record record;
+
+      while (d_queue.pop(record))
+      {
+        // Disk full, the record is lost and the file is extended again at the next commit
+        if (n == d_capacity && !map(d_capacity + JOURNAL_GROW_RECORDS))
+        {
+          lost++;
+          break;
+        }
+        h = header();
+        ((journal_record *) (d_map + JOURNAL_HEADER_SIZE))[n] = record;
+
+        // Sparse time index, halved when full
+        if (n % h->index_stride == 0)
+        {
+          if (h->n_index == JOURNAL_INDEX_ENTRIES)
+          {
+            for (int i = 0; i < JOURNAL_INDEX_ENTRIES / 2; i++)
+              h->index[i] = h->index[2 * i];
+            h->n_index = JOURNAL_INDEX_ENTRIES / 2;
+            h->index_stride *= 2;
+          }
+          if (n % h->index_stride == 0)
+            h->index[h->n_index++] = record.time_us;
+        }
+        n++;
+      }
+      if (n == first)
+      {
+        d_dropped.fetch_add(lost, boost::memory_order_relaxed);
+        d_processed.fetch_add(lost, boost::memory_order_release);
+        return;
+      }
+
+      // Records first, then the header that makes them visible (msync needs page aligned addresses)
+      size_t page  = sysconf(_SC_PAGESIZE);
+      size_t begin = (JOURNAL_HEADER_SIZE + first * sizeof(journal_record)) / page * page;
+      size_t end   = JOURNAL_HEADER_SIZE + n * sizeof(journal_record);
+      msync(d_map + begin, end - begin, MS_SYNC);
+
+      h->n_records = n;
+      msync(d_map, JOURNAL_HEADER_SIZE, MS_SYNC);
+      d_committed.fetch_add(n - first, boost::memory_order_relaxed);
+      d_dropped.fetch_add(lost, boost::memory_order_relaxed);
+      d_processed.fetch_add(n - first + lost, boost::memory_order_release);
+    }
+
+    void journal_writer::run()
+    {
+      while (!d_stop)
+      {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(d_commit_ms));
+        commit();
+      }
+      commit();
+    }
+
+    journal_reader::journal_reader()
+      : d_fd(-1), d_map(NULL), d_map_size(0), d_n_records(0)
+    {
+    }
+
+    journal_reader::~journal_reader()
+    {
+      close();
+    }
+
+    bool journal_reader::open(const std::string & path)
+    {
+      close();
+      d_fd = ::open(path.c_str(), O_RDONLY);
+      if (d_fd < 0)
+        return false;
+
+      struct stat st;
+      if (fstat(d_fd, &st) != 0 || st.st_size < JOURNAL_HEADER_SIZE)
+      {
+        close();
+        return false;
+      }
+      void * p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, d_fd, 0);
+      if (p == MAP_FAILED)
+      {
+        close();
+        return false;
+      }
+      d_map      = (const char *) p;
+      d_map_size = st.st_size;
+
+      const journal_header & h = header();
+      if (memcmp(h.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || h.version != JOURNAL_VERSION ||
+          h.record_size != sizeof(journal_record))
+      {
+        close();
+        return false;
+      }
+      d_n_records = std::min<uint64_t>(h.n_records, (d_map_size - JOURNAL_HEADER_SIZE) / sizeof(journal_record));
+      return true;
+    }
+
+    void journal_reader::close()
+    {
+      if (d_map != NULL)
+        munmap((void *) d_map, d_map_size);
+      if (d_fd >= 0)
+        ::close(d_fd);
+      d_fd = -1;
+      d_map = NULL;
+      d_n_records = 0;
+    }
+
+    const journal_record & journal_reader::operator[](uint64_t i) const
+    {
+      return ((const journal_record *) (d_map + JOURNAL_HEADER_SIZE))[i];
+    }
+
+    uint64_t journal_reader::seek(uint64_t time_us) const
+    {
+      const journal_header & h = header();
+
+      // Index entries bracketing time_us
+      uint64_t lo = 0, hi = d_n_records;
+      for (uint32_t i = 0; i < h.n_index; i++)
+      {
+        if (h.index[i] < time_us)
+          lo = uint64_t(i) * h.index_stride;
+        else
+        {
+          hi = std::min<uint64_t>(d_n_records, uint64_t(i) * h.index_stride);
+          break;
+        }
+      }
+
+      while (lo < hi)
+      {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if ((*this)[mid].time_us < time_us)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      return lo;
+    }
+
+    bool journal_compact(const std::string & in, const std::string & out, uint64_t window_us,
+                         journal_compact_stats & stats)
+    {
+      memset(&stats, 0, sizeof(stats));
+      journal_reader reader;
+      if (!reader.open(in))
+        return false;
+
+      std::vector<journal_record> records;
+      records.reserve(reader.size());
+      // (EPC, antenna) -> index of the last kept read
+      std::map<std::pair<epc_bits, int>, size_t> last;
+
+      for (uint64_t i = 0; i < reader.size(); i++)
+      {
+        const journal_record & r = reader[i];
+        stats.n_in++;
+        if (r.check != r.checksum() || r.n_bits > EPC_MAX_BITS)
+        {
+          stats.n_corrupt++;
+          continue;
+        }
+
+        if (window_us > 0 && r.type == JOURNAL_EPC)
+        {
+          std::pair<epc_bits, int> key(r.bits(), r.antenna);
+          std::map<std::pair<epc_bits, int>, size_t>::iterator it = last.find(key);
+          if (it != last.end() && r.time_us - records[it->second].time_us < window_us)
+          {
+            journal_record & kept = records[it->second];
+            uint32_t count = std::max<uint32_t>(kept.count, 1);
+            kept.ampl  = (kept.ampl * count + r.ampl) / (count + 1);
+            kept.phase = r.phase;
+            kept.count = count + std::max<uint32_t>(r.count, 1);
+            stats.n_merged++;
+            continue;
+          }
+          last[key] = records.size();
+        }
+        records.push_back(r);
+      }
+      for (size_t i = 0; i < records.size(); i++)
+        records[i].check = records[i].checksum();
+
+      // Exactly sized copy, written with plain I/O and renamed into place
+      std::string tmp = out + ".tmp";
+      int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+        return false;
+
+      std::vector<char> head(JOURNAL_HEADER_SIZE, 0);
+      journal_header & h = *(journal_header *) &head[0];
+      memcpy(&h, &reader.header(), sizeof(journal_header));
+      h.n_records    = records.size();
+      h.index_stride = 1;
+      h.n_index      = 0;
+      while (records.size() > uint64_t(h.index_stride) * JOURNAL_INDEX_ENTRIES)
+        h.index_stride *= 2;
+      for (size_t i = 0; i < records.size(); i += h.index_stride)
+        h.index[h.n_index++] = records[i].time_us;
+
+      size_t n_bytes = records.size() * sizeof(journal_record);
+      bool ok = write(fd, &head[0], head.size()) == (ssize_t) head.size() &&
+                (n_bytes == 0 || write(fd, &records[0], n_bytes) == (ssize_t) n_bytes) &&
+                fsync(fd) == 0;
+      ok = (::close(fd) == 0) && ok;
+      stats.n_out = records.size();
+      return ok && rename(tmp.c_str(), out.c_str()) == 0;
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,199 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "metrics.h"
+#include <time.h>
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+namespace gr {
+  namespace rfid {
+
+    static const char * METRIC_NAMES[NUM_METRICS] =
+    {
+      "queries", "slots", "empty_slots", "collisions", "rn16", "epc_correct", "epc_crc_fail", "t2_violations", "false_triggers", "missed_triggers",
+      "mem_reads", "mem_read_fail", "speculative_empty", "lost_commands", "duplicate_commands"
+    };
+
+    static const int WINDOWS[3] = {1, 10, 60};
+
+    metrics_registry::metrics_registry()
+    {
+      for (int b = 0; b < METRIC_BUCKETS; b++)
+      {
+        d_buckets[b].second = 0;
+        for (int m = 0; m < NUM_METRICS; m++)
+          d_buckets[b].count[m] = 0;
+      }
+      for (int m = 0; m < NUM_METRICS; m++)
+        d_total[m] = 0;
+      for (int b = 0; b < LATENCY_BUCKETS; b++)
+        d_latency[b] = 0;
+      d_latency_count = 0;
+      d_latency_sum   = 0;
+      d_latency_max   = 0;
+    }
+
+    uint64_t metrics_registry::now_s()
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec;
+    }
+
+    uint64_t metrics_registry::now_us()
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    uint64_t metrics_registry::epoch_us()
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    void metrics_registry::add(METRIC_ID id, uint64_t n)
+    {
+      uint64_t now = now_s();
+      bucket & b = d_buckets[now % METRIC_BUCKETS];
+      uint64_t second = b.second.load(boost::memory_order_acquire);
+
+      // First update in this second, recycle the bucket
+      if (second != now && b.second.compare_exchange_strong(second, now, boost::memory_order_acq_rel))
+      {
+        for (int m = 0; m < NUM_METRICS; m++)
+          b.count[m].store(0, boost::memory_order_relaxed);
+      }
+      b.count[id].fetch_add(n, boost::memory_order_relaxed);
+      d_total[id].fetch_add(n, boost::memory_order_relaxed);
+    }
+
+    uint64_t metrics_registry::total(METRIC_ID id) const
+    {
+      return d_total[id].load(boost::memory_order_relaxed);
+    }
+
+    uint64_t metrics_registry::window(METRIC_ID id, int window_s) const
+    {
+      uint64_t now = now_s(), sum = 0;
+
+      for (uint64_t s = now - window_s; s < now; s++)
+      {
+        const bucket & b = d_buckets[s % METRIC_BUCKETS];
+        if (b.second.load(boost::memory_order_acquire) == s)
+          sum += b.count[id].load(boost::memory_order_relaxed);
+      }
+      return sum;
+    }
+
+    float metrics_registry::rate(METRIC_ID id, int window_s) const
+    {
+      return float(window(id, window_s)) / window_s;
+    }
+
+    float metrics_registry::ratio(METRIC_ID num, METRIC_ID den, int window_s) const
+    {
+      uint64_t d = window(den, window_s);
+      return d == 0 ? 0 : float(window(num, window_s)) / d;
+    }
+
+    void metrics_registry::add_latency(uint64_t us)
+    {
+      d_latency[std::min<uint64_t>(us / LATENCY_BUCKET_US, LATENCY_BUCKETS - 1)].fetch_add(1, boost::memory_order_relaxed);
+      d_latency_count.fetch_add(1, boost::memory_order_relaxed);
+      d_latency_sum.fetch_add(us, boost::memory_order_relaxed);
+
+      uint64_t max = d_latency_max.load(boost::memory_order_relaxed);
+      while (us > max && !d_latency_max.compare_exchange_weak(max, us, boost::memory_order_relaxed));
+    }
+
+    uint64_t metrics_registry::latency_quantile(float q) const
+    {
+      uint64_t n = latency_count(), sum = 0;
+      if (n == 0)
+        return 0;
+
+      for (int b = 0; b < LATENCY_BUCKETS - 1; b++)
+      {
+        sum += d_latency[b].load(boost::memory_order_relaxed);
+        if (sum >= q * n)
+          return (b + 1) * LATENCY_BUCKET_US;
+      }
+      return latency_max();
+    }
+
+    std::string metrics_registry::prometheus_text() const
+    {
+      std::ostringstream out;
+
+      for (int m = 0; m < NUM_METRICS; m++)
+      {
+        out << "# TYPE rfid_" << METRIC_NAMES[m] << "_total counter\n";
+        out << "rfid_" << METRIC_NAMES[m] << "_total " << total(METRIC_ID(m)) << "\n";
+        out << "# TYPE rfid_" << METRIC_NAMES[m] << "_per_second gauge\n";
+        for (int w = 0; w < 3; w++)
+          out << "rfid_" << METRIC_NAMES[m] << "_per_second{window=\"" << WINDOWS[w] << "s\"} " << rate(METRIC_ID(m), WINDOWS[w]) << "\n";
+      }
+
+      out << "# TYPE rfid_ratio gauge\n";
+      for (int w = 0; w < 3; w++)
+      {
+        // RN16 decoded in the slots with a reply (single or collided), EPC decoded after an acknowledged RN16
+        uint64_t replies = window(METRIC_SLOTS, WINDOWS[w]);
+        replies -= std::min(replies, window(METRIC_EMPTY_SLOTS, WINDOWS[w]));
+        out << "rfid_ratio{name=\"rn16_success\",window=\"" << WINDOWS[w] << "s\"} " << (replies == 0 ? 0 : float(window(METRIC_RN16, WINDOWS[w])) / replies) << "\n";
+        out << "rfid_ratio{name=\"epc_success\",window=\"" << WINDOWS[w] << "s\"} " << ratio(METRIC_EPC_CORRECT, METRIC_RN16, WINDOWS[w]) << "\n";
+        out << "rfid_ratio{name=\"epc_crc_failure\",window=\"" << WINDOWS[w] << "s\"} " << ratio(METRIC_EPC_CRC_FAIL, METRIC_RN16, WINDOWS[w]) << "\n";
+        out << "rfid_ratio{name=\"empty\",window=\"" << WINDOWS[w] << "s\"} " << ratio(METRIC_EMPTY_SLOTS, METRIC_SLOTS, WINDOWS[w]) << "\n";
+        out << "rfid_ratio{name=\"collision\",window=\"" << WINDOWS[w] << "s\"} " << ratio(METRIC_COLLISIONS, METRIC_SLOTS, WINDOWS[w]) << "\n";
+      }
+
+      out << "# TYPE rfid_loop_latency_us summary\n";
+      out << "rfid_loop_latency_us{quantile=\"0.5\"} " << latency_quantile(0.5) << "\n";
+      out << "rfid_loop_latency_us{quantile=\"0.99\"} " << latency_quantile(0.99) << "\n";
+      out << "rfid_loop_latency_us{quantile=\"1\"} " << latency_max() << "\n";
+      out << "rfid_loop_latency_us_sum " << d_latency_sum.load(boost::memory_order_relaxed) << "\n";
+      out << "rfid_loop_latency_us_count " << latency_count() << "\n";
+      return out.str();
+    }
+
+    bool metrics_registry::export_file(const std::string & path) const
+    {
+      std::string tmp = path + ".tmp";
+      std::string text = prometheus_text();
+
+      FILE * f = fopen(tmp.c_str(), "w");
+      if (f == NULL)
+        return false;
+      bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+      ok = (fclose(f) == 0) && ok;
+      return ok && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,111 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_METRICS_H
+#define INCLUDED_RFID_METRICS_H
+
+#include <boost/atomic.hpp>
+#include <stdint.h>
+#include <string>
+
+namespace gr {
+  namespace rfid {
+
+    enum METRIC_ID
+    {
+      METRIC_QUERIES,         // Query/QueryRep/QueryAdjust sent
+      METRIC_SLOTS,           // RN16 windows decoded
+      METRIC_EMPTY_SLOTS,
+      METRIC_COLLISIONS,
+      METRIC_RN16,            // RN16 decoded and acknowledged
+      METRIC_EPC_CORRECT,
+      METRIC_EPC_CRC_FAIL,
+      METRIC_T2_VIOLATIONS,
+      METRIC_FALSE_TRIGGERS,  // Gate triggered while no Tag reply was expected
+      METRIC_MISSED_TRIGGERS, // Tag reply window without a detected command
+      METRIC_MEM_READS,       // Correct Read replies (access phase)
+      METRIC_MEM_READ_FAIL,
+      METRIC_SPECULATIVE_EMPTY, // Empty slots decided by the gate from the energy of the window
+      METRIC_LOST_COMMANDS,     // Sent commands the gate did not demodulate
+      METRIC_DUPLICATE_COMMANDS, // Demodulated commands that were not (or no longer) pending
+      NUM_METRICS
+    };
+
+    // One bucket per second, enough for the longest window
+    const int METRIC_BUCKETS = 64;
+
+    // Loop latency histogram, the last bucket holds 2 ms and more
+    const int LATENCY_BUCKET_US = 10;
+    const int LATENCY_BUCKETS   = 200;
+
+    /*!
+     * \brief Counters with fixed-memory rolling windows (1 s, 10 s, 60 s).
+     *
+     * add() is lock-free and may be called from any block. A bucket is recycled by the
+     * first writer of a new second, increments that race with the recycling may be lost.
+     */
+    class metrics_registry
+    {
+      public:
+        metrics_registry();
+
+        void add(METRIC_ID id, uint64_t n = 1);
+
+        uint64_t total(METRIC_ID id) const;
+        // Sum over the last window_s complete seconds
+        uint64_t window(METRIC_ID id, int window_s) const;
+        float rate(METRIC_ID id, int window_s) const;
+        float ratio(METRIC_ID num, METRIC_ID den, int window_s) const;
+
+        // Loop latency : end of a Tag reply (gate) to the next reader command, since the start
+        void add_latency(uint64_t us);
+        uint64_t latency_count() const { return d_latency_count.load(boost::memory_order_relaxed); }
+        uint64_t latency_max() const { return d_latency_max.load(boost::memory_order_relaxed); }
+        // Upper edge of the bucket of the q-quantile (0 without samples)
+        uint64_t latency_quantile(float q) const;
+
+        // Prometheus text exposition format
+        std::string prometheus_text() const;
+        // Written to a temporary file and renamed, so a scraper never reads a partial file
+        bool export_file(const std::string & path) const;
+
+        static uint64_t now_s();
+        static uint64_t now_us();
+        // Wall clock (us since the epoch), only to anchor time stamps
+        static uint64_t epoch_us();
+
+      private:
+        struct bucket
+        {
+          boost::atomic<uint64_t> second;
+          boost::atomic<uint64_t> count[NUM_METRICS];
+        };
+
+        bucket d_buckets[METRIC_BUCKETS];
+        boost::atomic<uint64_t> d_total[NUM_METRICS];
+
+        boost::atomic<uint64_t> d_latency[LATENCY_BUCKETS];
+        boost::atomic<uint64_t> d_latency_count, d_latency_sum, d_latency_max;
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_METRICS_H */
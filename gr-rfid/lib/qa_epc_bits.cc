@@ -0,0 +1,266 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "qa_epc_bits.h"
+#include "gen2_mac.h"
+#include "burst_arena.h"
+#include "rfid/global_vars.h"
+#include <rfid/epc_bits.h>
+#include <rfid/gate.h>
+#include <rfid/tag_decoder.h>
+#include <gnuradio/top_block.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <cppunit/TestAssert.h>
+#include <cmath>
+
+namespace gr {
+  namespace rfid {
+
+    namespace {
+
+      // Decimated ADC rate of apps/reader.py
+      const int    RX_RATE     = 400000;
+      const double HALF_BIT_RX = TAG_BIT_D / 2 * RX_RATE / 1e6;
+
+      const uint16_t XPC_W1 = 0x0042;
+      const uint16_t XPC_W2 = 0x5A5A;
+      const uint16_t XEB    = 0x8000;   // MSB of XPC_W1 : XPC_W2 follows
+
+      epc_bits epc_words(int n_words)
+      {
+        epc_bits words;
+        for (int w = 0; w < n_words; w++)
+          words.append(0xE200 + w, 16);
+        return words;
+      }
+
+      // PC + [XPC_W1 + [XPC_W2]] + EPC + CRC-16, as sent by a Tag (without the dummy bit)
+      epc_bits make_reply(int n_words, bool xi, bool xeb)
+      {
+        epc_bits reply;
+        reply.append((n_words << 11) | (xi ? 0x200 : 0), 16);
+        if (xi)
+          reply.append(XPC_W1 | (xeb ? XEB : 0), 16);
+        if (xi && xeb)
+          reply.append(XPC_W2, 16);
+        for (int w = 0; w < n_words; w++)
+          reply.append(0xE200 + w, 16);
+        reply.append(reply.crc16(reply.size()), 16);
+        return reply;
+      }
+
+      epc_bits flip(const epc_bits & bits, int bit)
+      {
+        epc_bits flipped;
+        for (int i = 0; i < bits.size(); i++)
+          flipped.push_back(bits[i] ^ (i == bit));
+        return flipped;
+      }
+
+      // FM0 reply after the matched filter of the reader, as passed by the gate : 12 preamble
+      // half bits, one unused half bit, two half bits per data bit, then the dummy bit
+      int fm0_burst(const epc_bits & reply, gr_complex h, gr_complex * out, int capacity)
+      {
+        std::vector<float> levels;
+        for (int k = 0; k < 2 * TAG_PREAMBLE_BITS; k++)
+          levels.push_back(TAG_PREAMBLE[k] == 1 ? 1 : -1);
+        levels.push_back(0);
+
+        int level = 1;
+        for (int j = 0; j <= reply.size(); j++)
+        {
+          if (j == reply.size() || reply[j])
+            level = -level;
+          levels.push_back(level);
+          levels.push_back(-level);
+        }
+
+        // Linear between half bit centers, the burst starts a few samples before the preamble
+        const double start = 3;
+        int n = std::min(capacity, (int) std::ceil(start + (levels.size() + 2) * HALF_BIT_RX));
+        for (int k = 0; k < n; k++)
+        {
+          double u = (k - start) / HALF_BIT_RX;
+          int i = std::floor(u);
+          float frac = u - i;
+          float a = (i >= 0 && i < (int) levels.size()) ? levels[i] : 0;
+          float b = (i >= 1 && i <= (int) levels.size()) ? levels[i - 1] : 0;
+          out[k] = h * (frac * a + (1 - frac) * b);
+        }
+        return n;
+      }
+
+      class qa_slot_source : public gr::sync_block
+      {
+        public:
+          qa_slot_source(int slot)
+            : gr::sync_block("qa_slot_source", gr::io_signature::make(0, 0, 0), gr::io_signature::make(1, 1, sizeof(int))),
+              d_slot(slot), d_sent(false) {}
+
+          int work(int noutput_items, gr_vector_const_void_star & input_items, gr_vector_void_star & output_items)
+          {
+            if (d_sent)
+              return WORK_DONE;
+            ((int *) output_items[0])[0] = d_slot;
+            d_sent = true;
+            return 1;
+          }
+
+        private:
+          int d_slot;
+          bool d_sent;
+      };
+
+      class qa_item_sink : public gr::sync_block
+      {
+        public:
+          qa_item_sink(int item_size)
+            : gr::sync_block("qa_item_sink", gr::io_signature::make(1, 1, item_size), gr::io_signature::make(0, 0, 0)) {}
+
+          int work(int noutput_items, gr_vector_const_void_star & input_items, gr_vector_void_star & output_items)
+          {
+            return noutput_items;
+          }
+      };
+
+      // One EPC reply through the tag_decoder, in a burst arena slot as after an ACK.
+      // Returns the EPC added to the inventory.
+      bool decode(const epc_bits & reply, epc_bits & epc)
+      {
+        // The gate sets up the reader state and the burst arena
+        gate::sptr gate_block     = gate::make(RX_RATE);
+        tag_decoder::sptr decoder = tag_decoder::make(RX_RATE);
+
+        // Singulated Tag, the MAC waits for its EPC
+        reader_state->mac->handle(MAC_EV_START);
+        reader_state->mac->handle(MAC_EV_RN16);
+        reader_state->decoder_status = DECODER_DECODE_EPC;
+
+        burst_arena & bursts = *reader_state->bursts;
+        int slot = bursts.acquire();
+        bursts.set_length(slot, fm0_burst(reply, std::polar(0.02f, 0.7f), bursts.samples(slot), bursts.capacity()));
+        bursts.set_time(slot, 0);
+        bursts.set_empty(slot, false);
+
+        gr::top_block_sptr tb = gr::make_top_block("qa_epc_bits");
+        boost::shared_ptr<qa_slot_source> source = gnuradio::get_initial_sptr(new qa_slot_source(slot));
+        boost::shared_ptr<qa_item_sink>   rn16   = gnuradio::get_initial_sptr(new qa_item_sink(sizeof(uint16_t)));
+        boost::shared_ptr<qa_item_sink>   debug  = gnuradio::get_initial_sptr(new qa_item_sink(sizeof(gr_complex)));
+        tb->connect(source, 0, decoder, 0);
+        tb->connect(decoder, 0, rn16, 0);
+        tb->connect(decoder, 1, debug, 0);
+        tb->run();
+
+        if (reader_state->reader_stats.tag_reads.size() != 1)
+          return false;
+        epc = reader_state->reader_stats.tag_reads.begin()->first;
+        return true;
+      }
+    }
+
+    void
+    qa_epc_bits::t1_pc_length()
+    {
+      // Shortest, default and longest EPC announced by the PC
+      const int n_words[3] = {0, 6, 31};
+
+      for (int i = 0; i < 3; i++)
+      {
+        epc_bits reply = make_reply(n_words[i], false, false);
+        CPPUNIT_ASSERT_EQUAL(16 * n_words[i], reply.pc_epc_bits());
+        CPPUNIT_ASSERT_EQUAL(0, reply.xpc_words());
+        CPPUNIT_ASSERT_EQUAL(16 + 16 * n_words[i] + 16, reply.reply_bits());
+        CPPUNIT_ASSERT_EQUAL(reply.size(), reply.reply_bits());
+        CPPUNIT_ASSERT(reply.epc() == epc_words(n_words[i]));
+        CPPUNIT_ASSERT(reply.check_crc());
+      }
+
+      // Within the fixed size of epc_bits and of the decoder buffers
+      CPPUNIT_ASSERT(make_reply(31, true, true).reply_bits() <= EPC_MAX_BITS);
+      CPPUNIT_ASSERT_EQUAL(EPC_MAX_REPLY_BITS, make_reply(31, true, true).reply_bits() + 1);
+    }
+
+    void
+    qa_epc_bits::t2_xpc_words()
+    {
+      // XI without XEB : XPC_W1 only
+      epc_bits reply = make_reply(6, true, false);
+      CPPUNIT_ASSERT_EQUAL(1, reply.xpc_words());
+      CPPUNIT_ASSERT_EQUAL(16 + 16 + 96 + 16, reply.reply_bits());
+      CPPUNIT_ASSERT_EQUAL(uint64_t(XPC_W1), reply.value(16, 16));
+      CPPUNIT_ASSERT(reply.epc() == epc_words(6));
+      CPPUNIT_ASSERT(reply.check_crc());
+
+      // XI and XEB : XPC_W1 and XPC_W2
+      reply = make_reply(6, true, true);
+      CPPUNIT_ASSERT_EQUAL(2, reply.xpc_words());
+      CPPUNIT_ASSERT_EQUAL(16 + 32 + 96 + 16, reply.reply_bits());
+      CPPUNIT_ASSERT_EQUAL(uint64_t(XPC_W2), reply.value(32, 16));
+      CPPUNIT_ASSERT(reply.epc() == epc_words(6));
+      CPPUNIT_ASSERT(reply.check_crc());
+
+      // Only the PC received yet : the longest layout is assumed
+      CPPUNIT_ASSERT_EQUAL(2, reply.sub(0, 16).xpc_words());
+      CPPUNIT_ASSERT_EQUAL(0, make_reply(6, false, false).sub(0, 16).xpc_words());
+    }
+
+    void
+    qa_epc_bits::t3_crc()
+    {
+      epc_bits reply = make_reply(31, true, false);
+      int n = reply.reply_bits();
+
+      // CRC-16 in the last 16 bits of the announced length, over everything before it
+      CPPUNIT_ASSERT_EQUAL(n, reply.size());
+      CPPUNIT_ASSERT_EQUAL(uint64_t(reply.crc16(n - 16)), reply.value(n - 16, 16));
+      CPPUNIT_ASSERT(reply.check_crc());
+
+      // One wrong bit, in the PC, the XPC or the EPC
+      const int flips[3] = {3, 20, n - 40};
+      for (int i = 0; i < 3; i++)
+        CPPUNIT_ASSERT(!flip(reply, flips[i]).check_crc());
+
+      // PC of 30 words on a 31 word reply : the announced length and its CRC do not match
+      epc_bits wrong_pc = flip(reply, 4);
+      n = wrong_pc.reply_bits();
+      CPPUNIT_ASSERT(n != wrong_pc.size());
+      CPPUNIT_ASSERT(wrong_pc.crc16(n - 16) != wrong_pc.value(n - 16, 16));
+    }
+
+    void
+    qa_epc_bits::t4_decoder()
+    {
+      // tag_detection_EPC reads the PC, then XPC_W1 if XI is set, then the announced length
+      const int  n_words[6] = {0, 6, 31, 6, 6, 31};
+      const bool xi[6]      = {false, false, false, true, true, true};
+      const bool xeb[6]     = {false, false, false, false, true, true};
+
+      for (int i = 0; i < 6; i++)
+      {
+        epc_bits epc;
+        CPPUNIT_ASSERT(decode(make_reply(n_words[i], xi[i], xeb[i]), epc));
+        CPPUNIT_ASSERT(epc == epc_words(n_words[i]));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), reader_state->reader_stats.n_epc_correct);
+      }
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
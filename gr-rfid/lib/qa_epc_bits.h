@@ -0,0 +1,54 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _QA_EPC_BITS_H_
+#define _QA_EPC_BITS_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace rfid {
+
+    /*
+     * Variable-length EPC replies : length announced by the PC, XPC words (XI, XEB)
+     * and CRC-16 over the announced length, in epc_bits and through the tag_decoder.
+     */
+    class qa_epc_bits : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_epc_bits);
+      CPPUNIT_TEST(t1_pc_length);
+      CPPUNIT_TEST(t2_xpc_words);
+      CPPUNIT_TEST(t3_crc);
+      CPPUNIT_TEST(t4_decoder);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t1_pc_length();
+      void t2_xpc_words();
+      void t3_crc();
+      void t4_decoder();
+    };
+
+  } /* namespace rfid */
+} /* namespace gr */
+
+#endif /* _QA_EPC_BITS_H_ */
@@ -0,0 +1,192 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "qa_gen2_mac.h"
+#include "gen2_mac.h"
+#include <cppunit/TestAssert.h>
+#include <cstdlib>
+#include <ctime>
+
+namespace gr {
+  namespace rfid {
+
+    // t6_throughput runs about 1e7 slots/s optimized and 4e6 under ThreadSanitizer, the bound leaves room for slow builds
+    static const double MIN_MAC_SLOTS_PER_S = 1e5;
+
+    static gen2_mac_config make_config(int q, int session, int n_access_ops)
+    {
+      gen2_mac_config config;
+      config.q            = q;
+      config.session      = session;
+      config.target       = 0;
+      config.flip_target  = false;
+      config.n_access_ops = n_access_ops;
+      return config;
+    }
+
+    void
+    qa_gen2_mac::t1_inventory_round()
+    {
+      // Q = 2 : Query + 3 QueryRep, then a new round
+      gen2_mac mac(make_config(2, 0, 0));
+
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_QUERY, mac.handle(MAC_EV_START));
+      CPPUNIT_ASSERT_EQUAL(MAC_WAIT_RN16, mac.state());
+      CPPUNIT_ASSERT_EQUAL(4, mac.max_slot());
+
+      for (int slot = 2; slot <= 4; slot++)
+      {
+        CPPUNIT_ASSERT_EQUAL(MAC_CMD_QUERY_REP, mac.handle(MAC_EV_NO_REPLY));
+        CPPUNIT_ASSERT_EQUAL(slot, mac.slot());
+        CPPUNIT_ASSERT(!mac.round_ended());
+      }
+
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_QUERY, mac.handle(MAC_EV_NO_REPLY));
+      CPPUNIT_ASSERT(mac.round_ended());
+      CPPUNIT_ASSERT_EQUAL(2, mac.round());
+      CPPUNIT_ASSERT_EQUAL(1, mac.slot());
+      CPPUNIT_ASSERT_EQUAL(uint64_t(5), mac.n_queries());
+      CPPUNIT_ASSERT_EQUAL(uint64_t(4), mac.n_slots());
+    }
+
+    void
+    qa_gen2_mac::t2_singulation()
+    {
+      gen2_mac mac(make_config(1, 0, 0));
+
+      mac.handle(MAC_EV_START);
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_ACK, mac.handle(MAC_EV_RN16));
+      CPPUNIT_ASSERT_EQUAL(MAC_WAIT_EPC, mac.state());
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_QUERY_REP, mac.handle(MAC_EV_EPC_OK));
+      CPPUNIT_ASSERT_EQUAL(uint64_t(1), mac.n_epc());
+
+      // A failed EPC also closes the slot, the Q change applies to the next round
+      mac.set_q(3);
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_ACK, mac.handle(MAC_EV_RN16));
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_QUERY, mac.handle(MAC_EV_EPC_FAIL));
+      CPPUNIT_ASSERT_EQUAL(uint64_t(1), mac.n_epc());
+      CPPUNIT_ASSERT_EQUAL(8, mac.max_slot());
+    }
+
+    void
+    qa_gen2_mac::t3_access_phase()
+    {
+      gen2_mac mac(make_config(1, 0, 2));
+
+      mac.handle(MAC_EV_START);
+      mac.handle(MAC_EV_RN16);
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_REQ_RN, mac.handle(MAC_EV_EPC_OK));
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_READ, mac.handle(MAC_EV_HANDLE_OK));
+      CPPUNIT_ASSERT_EQUAL(0, mac.access_op());
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_READ, mac.handle(MAC_EV_READ_DONE));
+      CPPUNIT_ASSERT_EQUAL(1, mac.access_op());
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_QUERY_REP, mac.handle(MAC_EV_READ_DONE));
+      CPPUNIT_ASSERT_EQUAL(2, mac.slot());
+
+      // No handle : back to inventory
+      mac.handle(MAC_EV_RN16);
+      mac.handle(MAC_EV_EPC_OK);
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_QUERY, mac.handle(MAC_EV_HANDLE_FAIL));
+      CPPUNIT_ASSERT(mac.round_ended());
+
+      // The Query of the new round is not sent yet, a Q set now applies to it
+      mac.set_q(3);
+      CPPUNIT_ASSERT_EQUAL(8, mac.max_slot());
+    }
+
+    void
+    qa_gen2_mac::t4_invalid_events()
+    {
+      gen2_mac mac(make_config(0, 0, 0));
+
+      // Nothing is expected before the first Query
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_NONE, mac.handle(MAC_EV_RN16));
+      CPPUNIT_ASSERT_EQUAL(MAC_IDLE, mac.state());
+
+      mac.handle(MAC_EV_START);
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_NONE, mac.handle(MAC_EV_EPC_OK));
+      CPPUNIT_ASSERT_EQUAL(MAC_CMD_NONE, mac.handle(MAC_EV_READ_DONE));
+      CPPUNIT_ASSERT_EQUAL(MAC_WAIT_RN16, mac.state());
+      CPPUNIT_ASSERT_EQUAL(uint64_t(3), mac.n_invalid());
+    }
+
+    void
+    qa_gen2_mac::t5_target_flip()
+    {
+      gen2_mac_config config = make_config(0, 2, 0);
+      config.flip_target = true;
+      gen2_mac mac(config);
+
+      // A round with a read keeps the target, an empty round flips it
+      mac.handle(MAC_EV_START);
+      mac.handle(MAC_EV_RN16);
+      mac.handle(MAC_EV_EPC_OK);
+      CPPUNIT_ASSERT_EQUAL(0, mac.target());
+      mac.handle(MAC_EV_NO_REPLY);
+      CPPUNIT_ASSERT_EQUAL(1, mac.target());
+
+      // A deferred EPC is a reply too
+      mac.handle(MAC_EV_RN16);
+      mac.handle(MAC_EV_EPC_DEFERRED);
+      CPPUNIT_ASSERT_EQUAL(1, mac.target());
+      CPPUNIT_ASSERT_EQUAL(uint64_t(1), mac.n_epc());
+
+      // Session 0 never flips
+      gen2_mac mac_s0(make_config(0, 0, 0));
+      mac_s0.handle(MAC_EV_START);
+      mac_s0.handle(MAC_EV_NO_REPLY);
+      CPPUNIT_ASSERT_EQUAL(0, mac_s0.target());
+    }
+
+    void
+    qa_gen2_mac::t6_throughput()
+    {
+      // Random reply outcomes, every event must be accepted in its state
+      const int n_events = 2000000;
+      gen2_mac mac(make_config(4, 1, 1));
+      MAC_COMMAND command = mac.handle(MAC_EV_START);
+      MAC_EVENT event = MAC_EV_START;
+      srand(1);
+
+      clock_t start = clock();
+      for (int i = 0; i < n_events; i++)
+      {
+        bool ok = (rand() & 3) != 0;
+        switch (command)
+        {
+          case MAC_CMD_QUERY:
+          case MAC_CMD_QUERY_REP: event = ok ? MAC_EV_RN16 : MAC_EV_NO_REPLY; break;
+          case MAC_CMD_ACK:       event = ok ? MAC_EV_EPC_OK : MAC_EV_EPC_FAIL; break;
+          case MAC_CMD_REQ_RN:    event = ok ? MAC_EV_HANDLE_OK : MAC_EV_HANDLE_FAIL; break;
+          case MAC_CMD_READ:      event = MAC_EV_READ_DONE; break;
+          default:                break;
+        }
+        command = mac.handle(event);
+      }
+      double elapsed = double(clock() - start) / CLOCKS_PER_SEC;
+
+      CPPUNIT_ASSERT_EQUAL(uint64_t(0), mac.n_invalid());
+      CPPUNIT_ASSERT(mac.n_slots() > 0);
+      CPPUNIT_ASSERT_EQUAL(mac.n_queries(), mac.n_slots() + 1);
+      CPPUNIT_ASSERT(elapsed == 0 || mac.n_slots() / elapsed > MIN_MAC_SLOTS_PER_S);
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
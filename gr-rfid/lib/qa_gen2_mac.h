@@ -0,0 +1,54 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _QA_GEN2_MAC_H_
+#define _QA_GEN2_MAC_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace rfid {
+
+    class qa_gen2_mac : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_gen2_mac);
+      CPPUNIT_TEST(t1_inventory_round);
+      CPPUNIT_TEST(t2_singulation);
+      CPPUNIT_TEST(t3_access_phase);
+      CPPUNIT_TEST(t4_invalid_events);
+      CPPUNIT_TEST(t5_target_flip);
+      CPPUNIT_TEST(t6_throughput);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t1_inventory_round();
+      void t2_singulation();
+      void t3_access_phase();
+      void t4_invalid_events();
+      void t5_target_flip();
+      void t6_throughput();
+    };
+
+  } /* namespace rfid */
+} /* namespace gr */
+
+#endif /* _QA_GEN2_MAC_H_ */
@@ -0,0 +1,717 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "qa_loop.h"
+#include "gen2_commands.h"
+#include "rfid/global_vars.h"
+#include <rfid/gate.h>
+#include <rfid/tag_decoder.h>
+#include <rfid/reader.h>
+#include <gnuradio/top_block.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <cppunit/TestAssert.h>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#include <cmath>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+namespace gr {
+  namespace rfid {
+
+    namespace {
+
+      // Rates and amplitude of apps/reader.py (2 MS/s ADC decimated by 5)
+      const int   TX_RATE   = 1000000;
+      const int   RX_RATE   = 400000;
+      const float AMPLITUDE = 0.1;
+
+      const uint32_t EMULATOR_SEED = 7;
+      const int LOOP_COMMANDS   = 300;      // Fewer Queries than MAX_NUM_QUERIES
+      const int LOOP_TIMEOUT_MS = 120000;   // Generous, for ThreadSanitizer builds
+
+      const double HALF_BIT_RX = TAG_BIT_D / 2 * RX_RATE / 1e6;
+
+      class qa_rng
+      {
+        public:
+          qa_rng(uint32_t seed) : d_engine(seed) {}
+          float uniform() { return d_uniform(d_engine); }
+          bool  chance(float p) { return uniform() < p; }
+          int   below(int n) { return std::min(n - 1, int(uniform() * n)); }
+        private:
+          boost::mt19937 d_engine;
+          boost::uniform_01<float> d_uniform;
+      };
+
+      enum TAG_STATE {TAG_READY, TAG_ARBITRATE, TAG_REPLY, TAG_ACKNOWLEDGED};
+
+      struct emulated_tag
+      {
+        gr_complex h;       // Backscatter channel
+        qa_rng rng;
+        TAG_STATE state;
+        int counter;        // Slot counter
+        uint16_t rn16;
+        gen2_bits epc;      // PC + EPC + CRC16
+
+        emulated_tag(gr_complex h_, uint32_t seed) : h(h_), rng(seed), state(TAG_READY), counter(0), rn16(0) {}
+      };
+
+      struct tag_reply
+      {
+        double start;                     // RX samples
+        gr_complex h;
+        std::vector<signed char> levels;  // Half bit levels
+
+        // After the matched filter of the reader (one half bit long), u half bits after the start
+        float level(double u) const
+        {
+          int h = std::floor(u);
+          float frac = u - h;
+          return frac * at(h) + (1 - frac) * at(h - 1);
+        }
+        float at(int h) const { return (h >= 0 && h < (int) levels.size()) ? levels[h] : 0; }
+      };
+
+      /*!
+       * Reader TX samples in, RX samples out. Commands are demodulated from the PIE
+       * waveform (rising edge intervals, data-1 if longer than RTcal/2), the Tags follow
+       * the Gen2 inventory state machine and their FM0 replies start T1 after the last
+       * rising edge of the command. RX sample k is TX sample k * TX_RATE / RX_RATE, plus the
+       * replies (after the matched filter) and noise. All the random draws follow the command
+       * sequence, the RX stream only depends on the TX stream.
+       *
+       * S0 flags revert to A between rounds (carrier drops), as in gen2_sim. A Tag misses
+       * a Query with probability p_miss and corrupts one EPC bit with probability p_corrupt.
+       */
+      class tag_emulator
+      {
+        public:
+          tag_emulator(float p_miss, float p_corrupt, uint32_t seed, int log_commands);
+
+          // Sink side
+          void transmit(const gr_complex * tx, int n);
+          // Source side, waits up to timeout_ms if no sample is ready
+          int receive(gr_complex * rx, int n, int timeout_ms);
+
+          int n_commands();
+          // One line per command (>) and reply (<), first log_commands commands (all : whole run)
+          std::string log(bool all = false);
+
+        private:
+          boost::mutex d_mutex;
+          boost::condition_variable d_rx_ready;
+          std::deque<gr_complex> d_rx;
+          std::ostringstream d_log;
+          int d_n_commands, d_log_commands;
+          long d_log_end;
+
+          float d_p_miss, d_p_corrupt;
+          qa_rng d_noise;
+          std::vector<emulated_tag> d_tags;
+          std::vector<tag_reply> d_replies;
+          int d_q;
+
+          // PIE demodulator
+          int64_t d_tx, d_rx_index, d_last_edge;
+          bool d_high, d_in_command, d_preamble;
+          double d_rtcal;                   // TX samples
+          std::vector<int64_t> d_rises;
+          std::vector<unsigned char> d_bits;
+
+          void step(const gr_complex & tx);
+          void rise();
+          bool complete();
+          void end_command(bool known);
+          void command();
+          uint32_t field(int first, int n) const;
+
+          void query(int target, int q);
+          void query_rep();
+          void query_adjust(int updn);
+          void ack(uint16_t rn16);
+          void nak();
+          void slot_replies();
+          void backscatter(const emulated_tag & tag, const gen2_bits & bits, int flip);
+      };
+
+      tag_emulator::tag_emulator(float p_miss, float p_corrupt, uint32_t seed, int log_commands)
+        : d_n_commands(0), d_log_commands(log_commands), d_log_end(-1), d_p_miss(p_miss), d_p_corrupt(p_corrupt), d_noise(seed), d_q(0),
+          d_tx(0), d_rx_index(0), d_last_edge(0), d_high(false), d_in_command(false), d_preamble(false),
+          d_rtcal(RTCAL_D * TX_RATE / 1e6)
+      {
+        // One dominant Tag, collisions are captured by the strongest reply
+        const float ampl[]  = {0.03, 0.01, 0.006};
+        const float phase[] = {0.3, 2.1, -1.4};
+        for (int i = 0; i < 3; i++)
+        {
+          emulated_tag tag(std::polar(ampl[i], phase[i]), seed * 31 + i);
+          tag.epc.append(0x3000, 16);   // PC : 6 words
+          tag.epc.append(0xE2801160, 32);
+          tag.epc.append(0x60000200, 32);
+          tag.epc.append(0x0A0B0000 + i, 32);
+          tag.epc.append_crc16();
+          d_tags.push_back(tag);
+        }
+      }
+
+      void tag_emulator::transmit(const gr_complex * tx, int n)
+      {
+        boost::mutex::scoped_lock lock(d_mutex);
+        for (int i = 0; i < n; i++)
+          step(tx[i]);
+        d_rx_ready.notify_one();
+      }
+
+      int tag_emulator::receive(gr_complex * rx, int n, int timeout_ms)
+      {
+        boost::mutex::scoped_lock lock(d_mutex);
+        if (d_rx.empty())
+          d_rx_ready.timed_wait(lock, boost::posix_time::milliseconds(timeout_ms));
+        n = std::min<int>(n, d_rx.size());
+        std::copy(d_rx.begin(), d_rx.begin() + n, rx);
+        d_rx.erase(d_rx.begin(), d_rx.begin() + n);
+        return n;
+      }
+
+      int tag_emulator::n_commands()
+      {
+        boost::mutex::scoped_lock lock(d_mutex);
+        return d_n_commands;
+      }
+
+      std::string tag_emulator::log(bool all)
+      {
+        boost::mutex::scoped_lock lock(d_mutex);
+        std::string text = d_log.str();
+        return (all || d_log_end < 0) ? text : text.substr(0, d_log_end);
+      }
+
+      void tag_emulator::step(const gr_complex & tx)
+      {
+        bool high = std::abs(tx) > AMPLITUDE / 2;
+        if (high && !d_high)
+          rise();
+        else if (!high && d_high)
+        {
+          // The delimiter starts a command
+          if (!d_in_command)
+          {
+            d_in_command = true;
+            d_preamble = false;
+            d_rises.clear();
+            d_bits.clear();
+          }
+          d_last_edge = d_tx;
+        }
+        d_high = high;
+
+        // No symbol is longer than TRcal (3 RTcal) : unknown command or carrier off
+        if (d_in_command && d_tx - d_last_edge > 4 * d_rtcal)
+        {
+          if (!d_bits.empty())
+            end_command(false);
+          d_in_command = false;
+        }
+
+        // RX samples up to this TX sample
+        for (; d_rx_index * TX_RATE / RX_RATE <= d_tx; d_rx_index++)
+        {
+          gr_complex rx = tx + gr_complex(d_noise.uniform() - 0.5f, d_noise.uniform() - 0.5f) * 1e-3f;
+          for (size_t r = 0; r < d_replies.size(); r++)
+            rx += d_replies[r].h * d_replies[r].level((d_rx_index - d_replies[r].start) / HALF_BIT_RX);
+          d_rx.push_back(rx);
+        }
+        for (size_t r = d_replies.size(); r-- > 0; )
+          if (d_rx_index > d_replies[r].start + (d_replies[r].levels.size() + 1) * HALF_BIT_RX)
+            d_replies.erase(d_replies.begin() + r);
+        d_tx++;
+      }
+
+      void tag_emulator::rise()
+      {
+        d_last_edge = d_tx;
+        if (!d_in_command)
+          return;
+
+        // Rising edges : data-0, RTcal, TRcal (Query only), then one per bit
+        d_rises.push_back(d_tx);
+        int n = d_rises.size();
+        if (n == 3)
+          d_rtcal = d_rises[2] - d_rises[1];
+        else if (n == 4 && d_rises[3] - d_rises[2] > 1.5 * d_rtcal)
+          d_preamble = true;
+        else if (n >= 4)
+          d_bits.push_back(d_rises[n-1] - d_rises[n-2] > d_rtcal / 2);
+
+        if (complete())
+          end_command(true);
+      }
+
+      uint32_t tag_emulator::field(int first, int n) const
+      {
+        uint32_t value = 0;
+        for (int i = first; i < first + n; i++)
+          value = (value << 1) | d_bits[i];
+        return value;
+      }
+
+      bool tag_emulator::complete()
+      {
+        int n = d_bits.size();
+        if (d_preamble)
+          return n == 22;
+        if (n < 2)
+          return false;
+        switch (field(0, 2))
+        {
+          case 0:  return n == 4;                              // QueryRep
+          case 1:  return n == 18;                             // ACK
+          case 2:  return n == 9 && field(0, 4) == 0x9;        // QueryAdjust
+          default: return n == 8 && field(0, 8) == 0xC0;       // NAK
+        }
+      }
+
+      void tag_emulator::end_command(bool known)
+      {
+        d_in_command = false;
+        d_n_commands++;
+        if (known)
+          command();
+        else
+          d_log << "> command " << d_bits.size() << " bits" << std::endl;
+
+        // Runs are compared up to the same command
+        if (d_n_commands == d_log_commands)
+          d_log_end = d_log.str().size();
+      }
+
+      void tag_emulator::command()
+      {
+        if (d_preamble)
+        {
+          if (field(0, 4) != 0x8 || gen2_crc5_bits(&d_bits[0], 17) != field(17, 5))
+          {
+            d_log << "> query crc error" << std::endl;
+            return;
+          }
+          d_log << "> query target=" << field(12, 1) << " q=" << field(13, 4) << std::endl;
+          query(field(12, 1), field(13, 4));
+        }
+        else if (field(0, 2) == 0)
+        {
+          d_log << "> query_rep" << std::endl;
+          query_rep();
+        }
+        else if (field(0, 2) == 1)
+        {
+          char rn16[8];
+          snprintf(rn16, sizeof(rn16), "%04x", field(2, 16));
+          d_log << "> ack " << rn16 << std::endl;
+          ack(field(2, 16));
+        }
+        else if (field(0, 4) == 0x9)
+        {
+          d_log << "> query_adjust " << field(6, 3) << std::endl;
+          query_adjust(field(6, 3));
+        }
+        else
+        {
+          d_log << "> nak" << std::endl;
+          nak();
+        }
+      }
+
+      void tag_emulator::query(int target, int q)
+      {
+        d_q = q;
+        for (size_t i = 0; i < d_tags.size(); i++)
+        {
+          emulated_tag & tag = d_tags[i];
+          bool miss   = tag.rng.chance(d_p_miss);
+          tag.counter = tag.rng.below(1 << q);
+          if (miss || target != 0)
+            tag.state = TAG_READY;
+          else
+            tag.state = (tag.counter == 0) ? TAG_REPLY : TAG_ARBITRATE;
+        }
+        slot_replies();
+      }
+
+      void tag_emulator::query_rep()
+      {
+        for (size_t i = 0; i < d_tags.size(); i++)
+        {
+          emulated_tag & tag = d_tags[i];
+          if (tag.state == TAG_ACKNOWLEDGED)
+            tag.state = TAG_READY;
+          else if (tag.state == TAG_REPLY)
+          {
+            tag.state   = TAG_ARBITRATE;
+            tag.counter = 0x7FFF;
+          }
+          else if (tag.state == TAG_ARBITRATE && --tag.counter == 0)
+            tag.state = TAG_REPLY;
+        }
+        slot_replies();
+      }
+
+      void tag_emulator::query_adjust(int updn)
+      {
+        if (updn == 6)
+          d_q = std::min(15, d_q + 1);
+        else if (updn == 3)
+          d_q = std::max(0, d_q - 1);
+
+        for (size_t i = 0; i < d_tags.size(); i++)
+        {
+          emulated_tag & tag = d_tags[i];
+          if (tag.state == TAG_ACKNOWLEDGED)
+            tag.state = TAG_READY;
+          else if (tag.state == TAG_REPLY || tag.state == TAG_ARBITRATE)
+          {
+            tag.counter = tag.rng.below(1 << d_q);
+            tag.state   = (tag.counter == 0) ? TAG_REPLY : TAG_ARBITRATE;
+          }
+        }
+        slot_replies();
+      }
+
+      void tag_emulator::ack(uint16_t rn16)
+      {
+        for (size_t i = 0; i < d_tags.size(); i++)
+        {
+          emulated_tag & tag = d_tags[i];
+          if (tag.state != TAG_REPLY && tag.state != TAG_ACKNOWLEDGED)
+            continue;
+          if (tag.rn16 != rn16)
+          {
+            tag.state   = TAG_ARBITRATE;
+            tag.counter = 0x7FFF;
+            continue;
+          }
+
+          tag.state = TAG_ACKNOWLEDGED;
+          gen2_bits reply = tag.epc;
+          reply.append(1, 1);    // Dummy bit
+          int flip = tag.rng.chance(d_p_corrupt) ? tag.rng.below(tag.epc.size()) : -1;
+          d_log << "< epc " << i << (flip >= 0 ? " corrupt" : "") << std::endl;
+          backscatter(tag, reply, flip);
+        }
+      }
+
+      void tag_emulator::nak()
+      {
+        for (size_t i = 0; i < d_tags.size(); i++)
+          if (d_tags[i].state == TAG_REPLY || d_tags[i].state == TAG_ACKNOWLEDGED)
+          {
+            d_tags[i].state   = TAG_ARBITRATE;
+            d_tags[i].counter = 0x7FFF;
+          }
+      }
+
+      void tag_emulator::slot_replies()
+      {
+        // Tags that entered the reply state backscatter a new RN16
+        std::ostringstream line;
+        for (size_t i = 0; i < d_tags.size(); i++)
+        {
+          emulated_tag & tag = d_tags[i];
+          if (tag.state != TAG_REPLY)
+            continue;
+          tag.rn16 = tag.rng.below(1 << 16);
+          gen2_bits reply;
+          reply.append(tag.rn16, 16);
+          reply.append(1, 1);
+          backscatter(tag, reply, -1);
+
+          char rn16[8];
+          snprintf(rn16, sizeof(rn16), "%04x", tag.rn16);
+          line << " " << i << ":" << rn16;
+        }
+        if (!line.str().empty())
+          d_log << "< rn16" << line.str() << std::endl;
+      }
+
+      void tag_emulator::backscatter(const emulated_tag & tag, const gen2_bits & bits, int flip)
+      {
+        // FM0 on the half bit grid of the decoder (as in tag_decoder_impl::cancel_tag) : 12 preamble
+        // half bits, one unused half bit, then two half bits per data bit
+        tag_reply reply;
+        reply.h = tag.h;
+        for (int k = 0; k < 2 * TAG_PREAMBLE_BITS; k++)
+          reply.levels.push_back(TAG_PREAMBLE[k] == 1 ? 1 : -1);
+        reply.levels.push_back(0);
+
+        int level = 1;
+        for (int j = 0; j < bits.size(); j++)
+        {
+          if (bits[j] ^ (j == flip))
+            level = -level;
+          reply.levels.push_back(level);
+          reply.levels.push_back(-level);
+        }
+
+        // T1 after the last rising edge of the command (plus a quarter bit, within the T1 tolerance)
+        double start_tx = d_tx + (T1_D + TAG_BIT_D / 4) * TX_RATE / 1e6;
+        reply.start = start_tx * RX_RATE / TX_RATE;
+        d_replies.push_back(reply);
+      }
+
+      // Reader -> emulated Tags -> gate, as the USRP sink and source of apps/reader.py
+      class qa_tx_sink : public gr::sync_block
+      {
+        public:
+          qa_tx_sink(tag_emulator * emulator)
+            : gr::sync_block("qa_tx_sink", gr::io_signature::make(1, 1, sizeof(gr_complex)), gr::io_signature::make(0, 0, 0)),
+              d_emulator(emulator) {}
+
+          int work(int noutput_items, gr_vector_const_void_star & input_items, gr_vector_void_star & output_items)
+          {
+            d_emulator->transmit((const gr_complex *) input_items[0], noutput_items);
+            return noutput_items;
+          }
+
+        private:
+          tag_emulator * d_emulator;
+      };
+
+      class qa_rx_source : public gr::sync_block
+      {
+        public:
+          qa_rx_source(tag_emulator * emulator)
+            : gr::sync_block("qa_rx_source", gr::io_signature::make(0, 0, 0), gr::io_signature::make(1, 1, sizeof(gr_complex))),
+              d_emulator(emulator) {}
+
+          // Does not block for long, the single-threaded scheduler runs the reader in the same thread
+          int work(int noutput_items, gr_vector_const_void_star & input_items, gr_vector_void_star & output_items)
+          {
+            return d_emulator->receive((gr_complex *) output_items[0], noutput_items, 1);
+          }
+
+        private:
+          tag_emulator * d_emulator;
+      };
+
+      class qa_null_sink : public gr::sync_block
+      {
+        public:
+          qa_null_sink()
+            : gr::sync_block("qa_null_sink", gr::io_signature::make(1, 1, sizeof(gr_complex)), gr::io_signature::make(0, 0, 0)) {}
+
+          int work(int noutput_items, gr_vector_const_void_star & input_items, gr_vector_void_star & output_items)
+          {
+            return noutput_items;
+          }
+      };
+
+      // Output buffer of a block, in items (both limits, GNU Radio rounds up to whole pages)
+      void random_buffer(gr::block & block, int port, qa_rng & rng, int min_items, int max_items)
+      {
+        long items = min_items + rng.below(max_items - min_items + 1);
+        block.set_min_output_buffer(port, items);
+        block.set_max_output_buffer(port, items);
+      }
+
+      int count(const std::string & log, const std::string & line)
+      {
+        int n = 0;
+        for (size_t pos = log.find(line); pos != std::string::npos; pos = log.find(line, pos + 1))
+          n++;
+        return n;
+      }
+
+      // EPCs sent without corruption and followed by a command, so already decoded by the reader
+      int intact_epcs(const std::string & log)
+      {
+        std::string answered = log.substr(0, log.rfind("\n> ") + 1);
+        return count(answered, "< epc ") - count(answered, " corrupt\n");
+      }
+
+      // One loop run, until the emulator saw LOOP_COMMANDS commands. Fails if the gate missed a
+      // reply window or triggered on a command, or if the reader did not decode every intact EPC.
+      // Returns the emulator log, buffer_seed = 0 keeps the default buffer sizes
+      bool run_loop(bool single_threaded, uint32_t buffer_seed, std::string & log)
+      {
+        setenv("GR_SCHEDULER", single_threaded ? "STS" : "TPB", 1);
+
+        tag_emulator emulator(0.3, 0.05, EMULATOR_SEED, LOOP_COMMANDS);
+        gr::top_block_sptr tb = gr::make_top_block("qa_loop");
+        gate::sptr gate_block       = gate::make(RX_RATE);
+        tag_decoder::sptr decoder   = tag_decoder::make(RX_RATE);
+        reader::sptr reader_block   = reader::make(RX_RATE, TX_RATE, AMPLITUDE);
+        boost::shared_ptr<qa_rx_source> source = gnuradio::get_initial_sptr(new qa_rx_source(&emulator));
+        boost::shared_ptr<qa_tx_sink>   sink    = gnuradio::get_initial_sptr(new qa_tx_sink(&emulator));
+        boost::shared_ptr<qa_null_sink> debug   = gnuradio::get_initial_sptr(new qa_null_sink());
+
+        if (buffer_seed != 0)
+        {
+          qa_rng rng(buffer_seed);
+          random_buffer(*source,     0, rng, 64, 65536);
+          random_buffer(*gate_block, 0, rng, 1, 4096);
+          random_buffer(*decoder,    0, rng, 1, 64);
+          random_buffer(*decoder,    1, rng, 64, 65536);
+          // Only an upper limit, the reader keeps room for its longest command
+          reader_block->set_max_output_buffer(0, 1 + rng.below(262144));
+        }
+
+        tb->connect(source, 0, gate_block, 0);
+        tb->connect(gate_block, 0, decoder, 0);
+        tb->connect(decoder, 0, reader_block, 0);
+        tb->connect(reader_block, 0, sink, 0);
+        tb->connect(decoder, 1, debug, 0);
+        tb->start();
+
+        for (int t = 0; t < LOOP_TIMEOUT_MS / 10 && emulator.n_commands() < LOOP_COMMANDS; t++)
+          boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        tb->stop();
+        tb->wait();
+
+        log = emulator.log();
+        READER_STATS & stats = reader_state->reader_stats;
+        bool checked = stats.n_false_triggers == 0 && stats.n_missed_triggers == 0 &&
+                       stats.n_epc_correct == uint64_t(intact_epcs(emulator.log(true)));
+        return emulator.n_commands() >= LOOP_COMMANDS && checked;
+      }
+
+      // Runs the loop in a child process, ThreadSanitizer reports make it exit with an error
+      std::string run_isolated(bool single_threaded, uint32_t buffer_seed)
+      {
+        int fd[2];
+        CPPUNIT_ASSERT(pipe(fd) == 0);
+        pid_t pid = fork();
+        CPPUNIT_ASSERT(pid >= 0);
+        if (pid == 0)
+        {
+          close(fd[0]);
+          std::string log;
+          bool done = run_loop(single_threaded, buffer_seed, log);
+          bool written = write(fd[1], log.data(), log.size()) == (ssize_t) log.size();
+          close(fd[1]);
+          exit(done && written ? 0 : 1);
+        }
+
+        close(fd[1]);
+        std::string log;
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd[0], buf, sizeof(buf))) > 0)
+          log.append(buf, n);
+        close(fd[0]);
+
+        int status;
+        waitpid(pid, &status, 0);
+        CPPUNIT_ASSERT_MESSAGE("loop stalled, crashed or raced", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        return log;
+      }
+    }
+
+    void
+    qa_loop::t1_emulator()
+    {
+      // Commands rendered as by the reader, Tags that always take part
+      tag_emulator emulator(0, 0, EMULATOR_SEED, LOOP_COMMANDS);
+      pie_encoder pie(TX_RATE, AMPLITUDE);
+      std::vector<gr_complex> tx(pie.max_samples(GEN2_MAX_COMMAND_BITS));
+      std::vector<gr_complex> cw(2000, gr_complex(AMPLITUDE, 0));
+      gen2_bits bits;
+      int n_tx = 0;
+
+      emulator.transmit(&cw[0], cw.size());
+      gen2_query query = {0, 0, 0, 0, 0, 0, 0};
+      query.encode(bits);
+      int n = pie.render(bits, true, &tx[0]);
+      emulator.transmit(&tx[0], n);
+      emulator.transmit(&cw[0], cw.size());
+      n_tx += 2 * cw.size() + n;
+
+      // Q = 0 : all the Tags reply in the first slot
+      std::string log = emulator.log();
+      unsigned rn16;
+      CPPUNIT_ASSERT(log.find("> query target=0 q=0\n< rn16 0:") == 0);
+      CPPUNIT_ASSERT_EQUAL(1, sscanf(log.c_str() + log.find("0:") + 2, "%x", &rn16));
+      CPPUNIT_ASSERT_EQUAL(1, count(log, " 2:"));
+
+      // Only the acknowledged Tag sends its EPC
+      gen2_ack ack = {uint16_t(rn16)};
+      ack.encode(bits);
+      n = pie.render(bits, false, &tx[0]);
+      emulator.transmit(&tx[0], n);
+      emulator.transmit(&cw[0], cw.size());
+      n_tx += cw.size() + n;
+
+      gen2_query_rep query_rep = {0};
+      query_rep.encode(bits);
+      n = pie.render(bits, false, &tx[0]);
+      emulator.transmit(&tx[0], n);
+      emulator.transmit(&cw[0], cw.size());
+      n_tx += cw.size() + n;
+
+      gen2_nak nak;
+      nak.encode(bits);
+      n = pie.render(bits, false, &tx[0]);
+      emulator.transmit(&tx[0], n);
+      emulator.transmit(&cw[0], cw.size());
+      n_tx += cw.size() + n;
+
+      log = emulator.log();
+      CPPUNIT_ASSERT_EQUAL(1, count(log, "< epc 0\n"));
+      CPPUNIT_ASSERT_EQUAL(0, count(log, "< epc 1"));
+      CPPUNIT_ASSERT_EQUAL(1, count(log, "> query_rep\n"));
+      CPPUNIT_ASSERT_EQUAL(1, count(log, "> nak\n"));
+      CPPUNIT_ASSERT_EQUAL(4, emulator.n_commands());
+
+      // RX samples follow the TX samples at the RX rate
+      std::vector<gr_complex> rx(n_tx);
+      int n_rx = 0;
+      while ((n = emulator.receive(&rx[n_rx], rx.size() - n_rx, 0)) > 0)
+        n_rx += n;
+      CPPUNIT_ASSERT(std::abs(n_rx - (double) n_tx * RX_RATE / TX_RATE) <= 1);
+    }
+
+    void
+    qa_loop::t2_thread_per_block()
+    {
+      // Slot outcomes must not depend on buffer sizes and thread interleaving
+      std::string reference = run_isolated(false, 0);
+      CPPUNIT_ASSERT(count(reference, "> ack ") > 0);
+      CPPUNIT_ASSERT(count(reference, "< epc ") > 0);
+
+      for (uint32_t seed = 1; seed <= 3; seed++)
+        CPPUNIT_ASSERT(run_isolated(false, seed) == reference);
+    }
+
+    void
+    qa_loop::t3_single_threaded()
+    {
+      std::string reference = run_isolated(false, 0);
+      CPPUNIT_ASSERT(run_isolated(true, 0) == reference);
+      CPPUNIT_ASSERT(run_isolated(true, 4) == reference);
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,53 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _QA_LOOP_H_
+#define _QA_LOOP_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace rfid {
+
+    /*
+     * gate -> tag_decoder -> reader loop closed through an emulated Tag population.
+     * Each run happens in a child process, so that it gets its own reader_state and
+     * scheduler (GR_SCHEDULER is read once per process).
+     */
+    class qa_loop : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_loop);
+      CPPUNIT_TEST(t1_emulator);
+      CPPUNIT_TEST(t2_thread_per_block);
+      CPPUNIT_TEST(t3_single_threaded);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t1_emulator();
+      void t2_thread_per_block();
+      void t3_single_threaded();
+    };
+
+  } /* namespace rfid */
+} /* namespace gr */
+
+#endif /* _QA_LOOP_H_ */
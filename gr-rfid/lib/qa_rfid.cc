@@ -26,11 +26,17 @@
  */
 
 #include "qa_rfid.h"
+#include "qa_gen2_mac.h"
+#include "qa_epc_bits.h"
+#include "qa_loop.h"
 
 CppUnit::TestSuite *
 qa_rfid::suite()
 {
   CppUnit::TestSuite *s = new CppUnit::TestSuite("rfid");
+  s->addTest(gr::rfid::qa_gen2_mac::suite());
+  s->addTest(gr::rfid::qa_epc_bits::suite());
+  s->addTest(gr::rfid::qa_loop::suite());
 
   return s;
 }
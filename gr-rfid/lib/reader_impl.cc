@@ -25,25 +25,45 @@
 #include <gnuradio/io_signature.h>
 #include "reader_impl.h"
 #include "rfid/global_vars.h"
-#include <sys/time.h>
+#include "metrics.h"
+#include "gen2_mac.h"
+#include <rfid/journal.h>
+#include "burst_capture.h"
+#include "command_log.h"
+#include "deploy_profile.h"
+#include <sstream>
 
 namespace gr {
   namespace rfid {
 
+    // Query words, CRC-5 included, for each Sel (0-3) and Target (A/B). Only these fields vary at runtime.
+    template <int SEL_, int TARGET_>
+    struct query_word : gen2_query_word<DR, QUERY_M, TREXT, SEL_, QUERY_SESSION, TARGET_, FIXED_Q> {};
+
+    static const uint64_t QUERY_WORDS[4][2] =
+    {
+      {query_word<0,0>::value, query_word<0,1>::value},
+      {query_word<1,0>::value, query_word<1,1>::value},
+      {query_word<2,0>::value, query_word<2,1>::value},
+      {query_word<3,0>::value, query_word<3,1>::value}
+    };
+
     reader::sptr
-    reader::make(int sample_rate, int dac_rate)
+    reader::make(int sample_rate, int dac_rate, float amplitude)
     {
       return gnuradio::get_initial_sptr
-        (new reader_impl(sample_rate,dac_rate));
+        (new reader_impl(sample_rate,dac_rate,amplitude));
     }
 
     /*
      * The private constructor
      */
-    reader_impl::reader_impl(int sample_rate, int dac_rate)
+    reader_impl::reader_impl(int sample_rate, int dac_rate, float amplitude)
       : gr::block("reader",
-              gr::io_signature::make( 1, 1, sizeof(float)),
-              gr::io_signature::make( 1, 1, sizeof(float)))
+              gr::io_signature::make( 1, 1, sizeof(uint16_t)),
+              gr::io_signature::make( 1, 1, sizeof(gr_complex))),
+              pie(dac_rate, amplitude), select_index(0), query_sel(SEL[0]*2 + SEL[1]), selects_built(false),
+              cw_pending(NULL), cw_written(0), cw_start_us(0)
     {
 
       GR_LOG_INFO(d_logger, "Block initialized");
@@ -51,114 +71,95 @@ namespace gr {
       sample_d = 1.0/dac_rate * pow(10,6);
 
       // Number of samples for transmitting
-
-      n_data0_s = 2 * PW_D / sample_d;
-      n_data1_s = 4 * PW_D / sample_d;
-      n_pw_s    = PW_D    / sample_d;
       n_cw_s    = CW_D    / sample_d;
-      n_delim_s = DELIM_D / sample_d;
-      n_trcal_s = TRCAL_D / sample_d;
 
-      GR_LOG_INFO(d_logger, "Number of samples data 0 : " << n_data0_s);
-      GR_LOG_INFO(d_logger, "Number of samples data 1 : " << n_data1_s);
+      GR_LOG_INFO(d_logger, "Number of samples data 0 : " << 2 * PW_D * pie.samples_per_us());
+      GR_LOG_INFO(d_logger, "Number of samples data 1 : " << 4 * PW_D * pie.samples_per_us());
       GR_LOG_INFO(d_logger, "Number of samples cw : "     << n_cw_s);
-      GR_LOG_INFO(d_logger, "Number of samples delim : "  << n_delim_s);
       GR_LOG_INFO(d_logger, "Number of slots : "          << std::pow(2,FIXED_Q));
 
       // CW waveforms of different sizes
       n_cwquery_s   = (T1_D+T2_D+RN16_D)/sample_d;     //RN16
-      n_cwack_s     = (3*T1_D+T2_D+EPC_D)/sample_d;    //EPC   if it is longer than nominal it wont cause tags to change inventoried flag
+      n_cwack_s     = cw_ack_length(EPC_BITS);         //EPC   if it is longer than nominal it wont cause tags to change inventoried flag
+      n_cwack_header_s = cw_ack_length(EPC_HEADER_BITS);
+      n_cwquery_early_s = (T1_D + GATE_EMPTY_BITS * TAG_BIT_D) / sample_d;
       n_p_down_s     = (P_DOWN_D)/sample_d;  
 
-      p_down.resize(n_p_down_s);        // Power down samples
-      cw_query.resize(n_cwquery_s);      // Sent after query/query rep
-      cw_ack.resize(n_cwack_s);          // Sent after ack
-
-      std::fill_n(cw_query.begin(), cw_query.size(), 1);
-      std::fill_n(cw_ack.begin(), cw_ack.size(), 1);
+      // Carrier at the output amplitude, power down is zero
+      const gr_complex carrier(amplitude, 0);
+      p_down.resize(n_p_down_s);                 // Power down samples
+      cw_query.resize(n_cwquery_s, carrier);     // Sent after query/query rep
+      cw_ack.resize(cw_ack_length(EPC_MAX_REPLY_BITS), carrier);   // Sent after ack, up to the longest EPC reply
+      cw.resize(n_cw_s, carrier);
+      cw_select.resize(SELECT_CW_D / sample_d, carrier);
+      cw_handle.resize((T1_D + T2_D + (HANDLE_BITS + TAG_PREAMBLE_BITS) * TAG_BIT_D) / sample_d, carrier);                           // Sent after Req_RN
+      cw_read.resize((T1_D + T2_D + (READ_REPLY_BITS + 16 * ACCESS_MAX_WORDS + TAG_PREAMBLE_BITS) * TAG_BIT_D) / sample_d, carrier);  // Sent after Read
 
       GR_LOG_INFO(d_logger, "Carrier wave after a query transmission in samples : "     << n_cwquery_s);
       GR_LOG_INFO(d_logger, "Carrier wave after ACK transmission in samples : "        << n_cwack_s);
 
-      // Construct vectors (resize() default initialization is zero)
-      data_0.resize(n_data0_s);
-      data_1.resize(n_data1_s);
-      cw.resize(n_cw_s);
-      delim.resize(n_delim_s);
-      rtcal.resize(n_data0_s + n_data1_s);
-      trcal.resize(n_trcal_s);
-
-      // Fill vectors with data
-      std::fill_n(data_0.begin(), data_0.size()/2, 1);
-      std::fill_n(data_1.begin(), 3*data_1.size()/4, 1);
-      std::fill_n(cw.begin(), cw.size(), 1);
-      std::fill_n(rtcal.begin(), rtcal.size() - n_pw_s, 1); // RTcal
-      std::fill_n(trcal.begin(), trcal.size() - n_pw_s, 1); // TRcal
-
-      // create preamble
-      preamble.insert( preamble.end(), delim.begin(), delim.end() );
-      preamble.insert( preamble.end(), data_0.begin(), data_0.end() );
-      preamble.insert( preamble.end(), rtcal.begin(), rtcal.end() );
-      preamble.insert( preamble.end(), trcal.begin(), trcal.end() );
-
-      // create framesync
-      frame_sync.insert( frame_sync.end(), delim.begin() , delim.end() );
-      frame_sync.insert( frame_sync.end(), data_0.begin(), data_0.end() );
-      frame_sync.insert( frame_sync.end(), rtcal.begin() , rtcal.end() );
-      
-      // create query rep
-      query_rep.insert( query_rep.end(), frame_sync.begin(), frame_sync.end());
-      query_rep.insert( query_rep.end(), data_0.begin(), data_0.end() );
-      query_rep.insert( query_rep.end(), data_0.begin(), data_0.end() );
-      query_rep.insert( query_rep.end(), data_0.begin(), data_0.end() );
-      query_rep.insert( query_rep.end(), data_0.begin(), data_0.end() );
-
-      // create nak
-      nak.insert( nak.end(), frame_sync.begin(), frame_sync.end());
-      nak.insert( nak.end(), data_1.begin(), data_1.end() );
-      nak.insert( nak.end(), data_1.begin(), data_1.end() );
-      nak.insert( nak.end(), data_0.begin(), data_0.end() );
-      nak.insert( nak.end(), data_0.begin(), data_0.end() );
-      nak.insert( nak.end(), data_0.begin(), data_0.end() );
-      nak.insert( nak.end(), data_0.begin(), data_0.end() );
-      nak.insert( nak.end(), data_0.begin(), data_0.end() );
-      nak.insert( nak.end(), data_0.begin(), data_0.end() );
-
-      gen_query_bits();
+      // A command and its CW are written at once : not called without room for the longest
+      long longest = pie.max_samples(GEN2_MAX_COMMAND_BITS) +
+                     std::max(std::max(std::max(n_cwquery_s, (int) cw_ack.size()), (int) std::max(cw_read.size(), p_down.size())),
+                              (int) std::max(std::max(cw.size(), cw_select.size()), cw_handle.size()));
+      set_min_noutput_items(longest);
+      set_min_output_buffer(longest);
+
+      if (DEPLOY_PROFILE)
+      {
+        // At most two commands queued for the sink
+        deploy_block(*this, DEPLOY_READER, longest, 2 * longest);
+        GR_LOG_INFO(d_logger, "Deployment profile : cores " << DEPLOY_CORES[0] << "/" << DEPLOY_CORES[1] << "/" << DEPLOY_CORES[2]
+                              << ", SCHED_FIFO " << DEPLOY_RT_PRIORITY << ", reader output buffer " << longest << " samples");
+      }
+
+      gen2_query_rep query_rep = {SESSION[0]*2 + SESSION[1]};
+      query_rep.encode(query_rep_bits);
+
+      gen2_nak nak;
+      nak.encode(nak_bits);
+
       gen_query_adjust_bits();
     }
 
-    void reader_impl::gen_query_bits()
+    void reader_impl::gen_query_bits(int sel)
     {
-      int num_ones = 0, num_zeros = 0;
-
-      query_bits.resize(0);
-      query_bits.insert(query_bits.end(), &QUERY_CODE[0], &QUERY_CODE[4]);
-      query_bits.push_back(DR);
-      query_bits.insert(query_bits.end(), &M[0], &M[2]);
-      query_bits.push_back(TREXT);
-      query_bits.insert(query_bits.end(), &SEL[0], &SEL[2]);
-      query_bits.insert(query_bits.end(), &SESSION[0], &SESSION[2]);
-      query_bits.push_back(TARGET);
-    
-      query_bits.insert(query_bits.end(), &Q_VALUE[FIXED_Q][0], &Q_VALUE[FIXED_Q][4]);
-      crc_append(query_bits);
+      query_bits.clear();
+      query_bits.append(QUERY_WORDS[sel][reader_state->cur_target], query_word<0,0>::length);
     }
 
 
-    void reader_impl::gen_ack_bits(const float * in)
+    void reader_impl::gen_ack_bits(uint16_t rn16)
     {
-      ack_bits.resize(0);
-      ack_bits.insert(ack_bits.end(), &ACK_CODE[0], &ACK_CODE[2]);
-      ack_bits.insert(ack_bits.end(), &in[0], &in[16]);
+      gen2_ack ack;
+      ack.rn16 = rn16;
+      ack.encode(ack_bits);
     }
   
+    void reader_impl::gen_req_rn_bits()
+    {
+      gen2_req_rn req_rn;
+      req_rn.rn = reader_state->access.rn16;
+      req_rn.encode(req_rn_bits);
+    }
+
+    void reader_impl::gen_read_bits()
+    {
+      const int * op = ACCESS_OPS[reader_state->access.op];
+      gen2_read read;
+      read.membank    = op[0];
+      read.word_ptr   = op[1];
+      read.word_count = access_read_words(reader_state->access.op);
+      read.handle     = reader_state->access.handle;
+      read.encode(read_bits);
+    }
+
     void reader_impl::gen_query_adjust_bits()
     {
-      query_adjust_bits.resize(0);
-      query_adjust_bits.insert(query_adjust_bits.end(), &QADJ_CODE[0], &QADJ_CODE[4]);
-      query_adjust_bits.insert(query_adjust_bits.end(), &SESSION[0], &SESSION[2]);
-      query_adjust_bits.insert(query_adjust_bits.end(), &Q_UPDN[1][0], &Q_UPDN[1][3]);
+      gen2_query_adjust query_adjust;
+      query_adjust.session = SESSION[0]*2 + SESSION[1];
+      query_adjust.updn    = Q_UPDN[1][0]*4 + Q_UPDN[1][1]*2 + Q_UPDN[1][2];
+      query_adjust.encode(query_adjust_bits);
     }
 
 
@@ -170,25 +171,149 @@ namespace gr {
 
     }
 
+    std::string reader_impl::results()
+    {
+      std::ostringstream out;
+      // May be called while the EPC worker updates the inventory
+      boost::mutex::scoped_lock lock(reader_state->inventory_mutex);
+
+      out << "\n --------------------------" << std::endl;
+      out << "| Number of queries/queryreps sent : " << reader_state->reader_stats.n_queries_sent - 1 << std::endl;
+      out << "| Current Inventory round : "          << reader_state->reader_stats.cur_inventory_round << std::endl;
+      out << " --------------------------"            << std::endl;
+
+      out << "| Correctly decoded EPC : "  <<  reader_state->reader_stats.n_epc_correct     << std::endl;
+      out << "| Number of unique tags : "  <<  reader_state->reader_stats.tag_reads.size() << std::endl;
+      if (SELECT_FILTER)
+        out << "| Number of selects sent : " <<  reader_state->reader_stats.n_selects_sent << std::endl;
+      if (COLLISION_RECOVERY)
+        out << "| Collisions (recovered) : " <<  reader_state->reader_stats.n_collisions << " (" << reader_state->reader_stats.n_collisions_recovered << ")" << std::endl;
+
+      if (ACCESS_READ)
+        out << "| Handles / memory reads (failed) : " <<  reader_state->reader_stats.n_handles << " / " << reader_state->reader_stats.n_mem_reads << " (" << reader_state->reader_stats.n_mem_read_fail << ")" << std::endl;
+      if (reader_state->journal != NULL)
+        out << "| Journaled reads (dropped) : " <<  reader_state->journal->n_committed() << " (" << reader_state->journal->n_dropped() << ")" << std::endl;
+      if (reader_state->capture != NULL)
+        out << "| Captured bursts (dropped) : " <<  reader_state->capture->n_captured() << " (" << reader_state->capture->n_dropped() << ")" << std::endl;
+      if (reader_state->metrics->latency_count() > 0)
+        out << "| Loop latency p50/p99/max : " << reader_state->metrics->latency_quantile(0.5) << "/" << reader_state->metrics->latency_quantile(0.99) << "/"
+            << reader_state->metrics->latency_max() << " us (T2 " << T2_D << " us, violations " << reader_state->metrics->total(METRIC_T2_VIOLATIONS) << ")" << std::endl;
+      // Fraction of the run during which Tags were sending correct EPCs
+      uint64_t end_us = reader_state->reader_stats.end_us ? reader_state->reader_stats.end_us.load() : metrics_registry::now_us();
+      if (end_us > reader_state->reader_stats.start_us)
+        out << "| EPC airtime efficiency : " << 100.0 * reader_state->reader_stats.epc_airtime_us / (end_us - reader_state->reader_stats.start_us) << " %" << std::endl;
+      out << "| Gate false/missed triggers : " <<  reader_state->reader_stats.n_false_triggers << "/" << reader_state->reader_stats.n_missed_triggers << std::endl;
+      if (GATE_COMMAND_DECODER)
+        out << "| Gate lost/duplicate commands : " <<  reader_state->reader_stats.n_lost_commands << "/" << reader_state->reader_stats.n_duplicate_commands << std::endl;
+
+      std::map<epc_bits,int>::iterator it;
+
+      for(it = reader_state->reader_stats.tag_reads.begin(); it != reader_state->reader_stats.tag_reads.end(); it++) 
+      {
+        out << "| EPC : " << it->first.to_hex() << "  ";
+        out << "Num of reads : " << it->second;
+
+        // Read intervals from the RX time of the replies
+        std::map<epc_bits,TAG_TIMES>::iterator it_t = reader_state->reader_stats.tag_times.find(it->first);
+        if (it_t != reader_state->reader_stats.tag_times.end() && it_t->second.n_reads > 1)
+        {
+          const TAG_TIMES & times = it_t->second;
+          out << "  Read interval min/mean/max : " << times.interval_min_us / 1e3 << "/"
+              << times.interval_sum_us / 1e3 / (times.n_reads - 1) << "/" << times.interval_max_us / 1e3 << " ms";
+        }
+        out << std::endl;
+      }
+
+      std::map<std::pair<epc_bits,int>, TAG_CHANNEL>::iterator it_ch;
+
+      for(it_ch = reader_state->reader_stats.tag_channels.begin(); it_ch != reader_state->reader_stats.tag_channels.end(); it_ch++) 
+      {
+        out << "| EPC : " << it_ch->first.first.to_hex() << "  Antenna : " << it_ch->first.second << "  ";
+        out << "Amplitude : " << it_ch->second.ampl_avg << "  Phase : " << std::arg(it_ch->second.h_avg) << std::endl;
+      }
+
+      std::map<std::pair<epc_bits,int>, epc_bits>::iterator it_mem;
+
+      for(it_mem = reader_state->reader_stats.tag_memory.begin(); it_mem != reader_state->reader_stats.tag_memory.end(); it_mem++) 
+      {
+        const int * op = ACCESS_OPS[it_mem->first.second];
+        out << "| EPC : " << it_mem->first.first.to_hex() << "  Bank : " << op[0] << "  Word : " << op[1] << "  ";
+        out << "Data : " << it_mem->second.to_hex() << std::endl;
+      }
+
+      out << " --------------------------" << std::endl;
+      return out.str();
+    }
+
     void reader_impl::print_results()
     {
-      std::cout << "\n --------------------------" << std::endl;
-      std::cout << "| Number of queries/queryreps sent : " << reader_state->reader_stats.n_queries_sent - 1 << std::endl;
-      std::cout << "| Current Inventory round : "          << reader_state->reader_stats.cur_inventory_round << std::endl;
-      std::cout << " --------------------------"            << std::endl;
+      std::cout << results();
+    }
 
-      std::cout << "| Correctly decoded EPC : "  <<  reader_state->reader_stats.n_epc_correct     << std::endl;
-      std::cout << "| Number of unique tags : "  <<  reader_state->reader_stats.tag_reads.size() << std::endl;
+    void reader_impl::check_t2()
+    {
+      // Reader command issued later than T2 after the end of the Tag reply
+      if (reader_state->tag_reply_end_us != 0)
+      {
+        uint64_t latency = metrics_registry::now_us() - reader_state->tag_reply_end_us;
+        reader_state->metrics->add_latency(latency);
+        if (latency > T2_D)
+          reader_state->metrics->add(METRIC_T2_VIOLATIONS);
+        reader_state->tag_reply_end_us = 0;
+      }
+    }
 
-      std::map<int,int>::iterator it;
+    int reader_impl::render(const gen2_bits & bits, bool preamble, gr_complex * out)
+    {
+      int n = pie.render(bits, preamble, out);
+      // Checked by the gate against the command it demodulates
+      if (GATE_COMMAND_DECODER && !reader_state->commands->sent(bits, preamble, n * sample_d))
+        GR_LOG_WARN(d_logger, "Command log full, the gate does not drain it");
+      return n;
+    }
 
-      for(it = reader_state->reader_stats.tag_reads.begin(); it != reader_state->reader_stats.tag_reads.end(); it++) 
+    int reader_impl::cw_ack_length(int reply_bits) const
+    {
+      return (3*T1_D + T2_D + (reply_bits + TAG_PREAMBLE_BITS) * TAG_BIT_D) / sample_d;
+    }
+
+    int reader_impl::write_cw(const std::vector<gr_complex> & cw_samples, int n_early, gr_complex * out)
+    {
+      memcpy(out, &cw_samples[0], sizeof(gr_complex) * n_early);
+      cw_pending  = &cw_samples;
+      cw_written  = n_early;
+      cw_start_us = metrics_registry::now_us();
+      return n_early;
+    }
+
+    int reader_impl::write_cw_query(gr_complex * out)
+    {
+      // Up to the speculative empty slot decision of the gate, the rest only if the slot is not empty
+      if (SPECULATIVE_EMPTY)
+        return write_cw(cw_query, n_cwquery_early_s, out);
+      memcpy(out, &cw_query[0], sizeof(gr_complex) * cw_query.size());
+      return cw_query.size();
+    }
+
+    int reader_impl::extend_cw(gr_complex * out, int max_items)
+    {
+      // EPC reply up to the length read by the gate, otherwise in steps up to the whole CW
+      int reply_bits = (cw_pending == &cw_ack) ? reader_state->epc_reply_bits.load() : 0;
+      int needed = (reply_bits > 0) ? cw_ack_length(reply_bits) : cw_pending->size();
+      int n = needed - cw_written;
+      if (reply_bits == 0)
       {
-        std::cout << std::hex <<  "| Tag ID : " << it->first << "  ";
-        std::cout << "Num of reads : " << std::dec << it->second << std::endl;
+        // No more than CW_LEAD_D ahead of real time, the reply may still turn out short (or absent)
+        float lead_us = cw_written * sample_d - (metrics_registry::now_us() - cw_start_us);
+        n = (lead_us < CW_LEAD_D) ? std::min(n, (int) (CW_LEAD_D / sample_d)) : 0;
       }
+      n = std::max(0, std::min(n, max_items));
 
-      std::cout << " --------------------------" << std::endl;
+      memcpy(out, &(*cw_pending)[cw_written], sizeof(gr_complex) * n);
+      cw_written += n;
+      if (cw_written >= needed)
+        cw_pending = NULL;
+      return n;
     }
 
     void
@@ -204,46 +329,49 @@ namespace gr {
                        gr_vector_void_star &output_items)
     {
 
-      const float *in = (const float *) input_items[0];
-      float *out =  (float*) output_items[0];
+      const uint16_t *in = (const uint16_t *) input_items[0];
+      gr_complex *out =  (gr_complex*) output_items[0];
       std::vector<float> out_message; 
       int n_output;
       int consumed = 0;
       int written = 0;
 
       consumed = ninput_items[0];
+
+      // The CW of the last command is no longer extended once the next command is due
+      if (reader_state->gen2_logic_status != IDLE)
+        cw_pending = NULL;
   
       switch (reader_state->gen2_logic_status)
       {
         case START:
           GR_LOG_INFO(d_debug_logger, "START");
 
-          memcpy(&out[written], &cw_ack[0], sizeof(float) * cw_ack.size() );
-          written += cw_ack.size();
+          memcpy(&out[written], &cw_ack[0], sizeof(gr_complex) * n_cwack_s );
+          written += n_cwack_s;
+          reader_state->mac->handle(MAC_EV_START);
           reader_state->gen2_logic_status = SEND_QUERY;    
           break;
 
         case POWER_DOWN:
           GR_LOG_INFO(d_debug_logger, "POWER DOWN");
-          memcpy(&out[written], &p_down[0], sizeof(float) * p_down.size() );
+          memcpy(&out[written], &p_down[0], sizeof(gr_complex) * p_down.size() );
           written += p_down.size();
           reader_state->gen2_logic_status = START;    
           break;
 
         case SEND_NAK_QR:
           GR_LOG_INFO(d_debug_logger, "SEND NAK");
-          memcpy(&out[written], &nak[0], sizeof(float) * nak.size() );
-          written += nak.size();
-          memcpy(&out[written], &cw[0], sizeof(float) * cw.size() );
+          written += render(nak_bits, false, &out[written]);
+          memcpy(&out[written], &cw[0], sizeof(gr_complex) * cw.size() );
           written+=cw.size();
           reader_state->gen2_logic_status = SEND_QUERY_REP;    
           break;
 
         case SEND_NAK_Q:
           GR_LOG_INFO(d_debug_logger, "SEND NAK");
-          memcpy(&out[written], &nak[0], sizeof(float) * nak.size() );
-          written += nak.size();
-          memcpy(&out[written], &cw[0], sizeof(float) * cw.size() );
+          written += render(nak_bits, false, &out[written]);
+          memcpy(&out[written], &cw[0], sizeof(gr_complex) * cw.size() );
           written+=cw.size();
           reader_state->gen2_logic_status = SEND_QUERY;    
           break;
@@ -255,65 +383,74 @@ namespace gr {
             std::cout << "Running " << std::endl;
           }*/
 
+          // Select commands are sent before the Query of each inventory round
+          if (SELECT_FILTER && !selects_built)
+          {
+            query_sel     = sel_policy.build(selects);
+            select_index  = 0;
+            selects_built = true;
+            if (!selects.empty())
+            {
+              reader_state->gen2_logic_status = SEND_SELECT;
+              break;
+            }
+          }
+          selects_built = false;
+
+          // Target may change between rounds (continuous inventory)
+          gen_query_bits(query_sel);
+
           GR_LOG_INFO(d_debug_logger, "QUERY");
           GR_LOG_INFO(d_debug_logger, "INVENTORY ROUND : " << reader_state->reader_stats.cur_inventory_round << " SLOT NUMBER : " << reader_state->reader_stats.cur_slot_number);
 
-          reader_state->reader_stats.n_queries_sent +=1;  
+          check_t2();
+          reader_state->reader_stats.n_queries_sent +=1;
+          reader_state->metrics->add(METRIC_QUERIES);  
           // Controls the other two blocks
           reader_state->decoder_status = DECODER_DECODE_RN16;
           reader_state->gate_status    = GATE_SEEK_RN16;
 
-          memcpy(&out[written], &preamble[0], sizeof(float) * preamble.size() );
-          written+=preamble.size();
-   
-          for(int i = 0; i < query_bits.size(); i++)
-          {
-            if(query_bits[i] == 1)
-            {
-              memcpy(&out[written], &data_1[0], sizeof(float) * data_1.size() );
-              written+=data_1.size();
-            }
-            else
-            {
-              memcpy(&out[written], &data_0[0], sizeof(float) * data_0.size() );
-              written+=data_0.size();
-            }
-          }
+          written += render(query_bits, true, &out[written]);
+
           // Send CW for RN16
-          memcpy(&out[written], &cw_query[0], sizeof(float) * cw_query.size() );
-          written+=cw_query.size();
+          written += write_cw_query(&out[written]);
 
           // Return to IDLE
           reader_state->gen2_logic_status = IDLE;      
           break;
 
+        case SEND_SELECT:
+          // One Select per call, followed by T4 of CW
+          selects[select_index].encode(select_bits);
+          if (noutput_items < pie.max_samples(select_bits.size()) + cw_select.size())
+            break;
+
+          GR_LOG_INFO(d_debug_logger, "SEND SELECT");
+          written += render(select_bits, false, &out[written]);
+          memcpy(&out[written], &cw_select[0], sizeof(gr_complex) * cw_select.size() );
+          written += cw_select.size();
+          reader_state->reader_stats.n_selects_sent += 1;
+
+          if (++select_index == selects.size())
+            reader_state->gen2_logic_status = SEND_QUERY;
+          break;
+
         case SEND_ACK:
           GR_LOG_INFO(d_debug_logger, "SEND ACK");
-          if (ninput_items[0] == RN16_BITS - 1)
+          if (ninput_items[0] > 0)
           {
             // Controls the other two blocks
+            reader_state->epc_reply_bits = 0;
             reader_state->decoder_status = DECODER_DECODE_EPC;
             reader_state->gate_status    = GATE_SEEK_EPC;
 
-            gen_ack_bits(in);
+            check_t2();
+            // Latest RN16, one item per slot
+            gen_ack_bits(in[ninput_items[0] - 1]);
           
-            // Send FrameSync
-            memcpy(&out[written], &frame_sync[0], sizeof(float) * frame_sync.size() );
-            written += frame_sync.size();
+            // Send FrameSync + ACK
+            written += render(ack_bits, false, &out[written]);
 
-            for(int i = 0; i < ack_bits.size(); i++)
-            {
-              if(ack_bits[i] == 1)
-              {
-                memcpy(&out[written], &data_1[0], sizeof(float) * data_1.size() );
-                written += data_1.size();
-              }
-              else  
-              {
-                memcpy(&out[written], &data_0[0], sizeof(float) * data_0.size() );
-                written += data_0.size();
-              }
-            }
              consumed = ninput_items[0];
             reader_state->gen2_logic_status = SEND_CW; 
           }
@@ -321,24 +458,55 @@ namespace gr {
 
         case SEND_CW:
           GR_LOG_INFO(d_debug_logger, "SEND CW");
-          memcpy(&out[written], &cw_ack[0], sizeof(float) * cw_ack.size() );
-          written += cw_ack.size();
+          // Up to the PC word of the EPC reply, extended while IDLE
+          written += write_cw(cw_ack, n_cwack_header_s, &out[written]);
           reader_state->gen2_logic_status = IDLE;      // Return to IDLE
           break;
 
+        case SEND_REQ_RN:
+          GR_LOG_INFO(d_debug_logger, "SEND REQ_RN");
+          // Controls the other two blocks
+          reader_state->decoder_status = DECODER_DECODE_HANDLE;
+          reader_state->gate_status    = GATE_SEEK_HANDLE;
+          check_t2();
+
+          gen_req_rn_bits();
+          written += render(req_rn_bits, false, &out[written]);
+
+          memcpy(&out[written], &cw_handle[0], sizeof(gr_complex) * cw_handle.size());
+          written += cw_handle.size();
+          reader_state->gen2_logic_status = IDLE;    // Return to IDLE
+          break;
+
+        case SEND_READ:
+          GR_LOG_INFO(d_debug_logger, "SEND READ " << reader_state->access.op);
+          // Controls the other two blocks
+          reader_state->decoder_status = DECODER_DECODE_READ;
+          reader_state->gate_status    = GATE_SEEK_READ;
+          check_t2();
+
+          // Same handle for all the reads, the Tag stays in the Open/Secured state
+          gen_read_bits();
+          written += render(read_bits, false, &out[written]);
+
+          memcpy(&out[written], &cw_read[0], sizeof(gr_complex) * cw_read.size());
+          written += cw_read.size();
+          reader_state->gen2_logic_status = IDLE;    // Return to IDLE
+          break;
+
         case SEND_QUERY_REP:
           GR_LOG_INFO(d_debug_logger, "SEND QUERY_REP");
           GR_LOG_INFO(d_debug_logger, "INVENTORY ROUND : " << reader_state->reader_stats.cur_inventory_round << " SLOT NUMBER : " << reader_state->reader_stats.cur_slot_number);
           // Controls the other two blocks
           reader_state->decoder_status = DECODER_DECODE_RN16;
           reader_state->gate_status    = GATE_SEEK_RN16;
-          reader_state->reader_stats.n_queries_sent +=1;  
+          check_t2();
+          reader_state->reader_stats.n_queries_sent +=1;
+          reader_state->metrics->add(METRIC_QUERIES);  
 
-          memcpy(&out[written], &query_rep[0], sizeof(float) * query_rep.size() );
-          written += query_rep.size();
+          written += render(query_rep_bits, false, &out[written]);
 
-          memcpy(&out[written], &cw_query[0], sizeof(float) * cw_query.size());
-          written+=cw_query.size();
+          written += write_cw_query(&out[written]);
 
           reader_state->gen2_logic_status = IDLE;    // Return to IDLE
           break;
@@ -348,99 +516,26 @@ namespace gr {
           // Controls the other two blocks
           reader_state->decoder_status = DECODER_DECODE_RN16;
           reader_state->gate_status    = GATE_SEEK_RN16;
-          reader_state->reader_stats.n_queries_sent +=1;  
+          check_t2();
+          reader_state->reader_stats.n_queries_sent +=1;
+          reader_state->metrics->add(METRIC_QUERIES);  
 
-          memcpy(&out[written], &frame_sync[0], sizeof(float) * frame_sync.size() );
-          written += frame_sync.size();
+          written += render(query_adjust_bits, false, &out[written]);
 
-          for(int i = 0; i < query_adjust_bits.size(); i++)
-          {
-            if(query_adjust_bits[i] == 1)
-            {
-              memcpy(&out[written], &data_1[0], sizeof(float) * data_1.size() );
-              written+=data_1.size();
-            }
-            else
-            {
-              memcpy(&out[written], &data_0[0], sizeof(float) * data_0.size() );
-              written+=data_0.size();
-            }
-          }
-          memcpy(&out[written], &cw_query[0], sizeof(float) * cw_query.size());
-          written+=cw_query.size();
+          written += write_cw_query(&out[written]);
           reader_state->gen2_logic_status = IDLE;    // Return to IDLE
           break;
 
         default:
           // IDLE
+          if (cw_pending != NULL)
+            written += extend_cw(&out[written], noutput_items - written);
           break;
       }
       consume_each (consumed);
       return  written;
     }
 
-    /* Function adapted from https://www.cgran.org/wiki/Gen2 */
-    void reader_impl::crc_append(std::vector<float> & q)
-    {
-       int crc[] = {1,0,0,1,0};
-
-      for(int i = 0; i < 17; i++)
-      {
-        int tmp[] = {0,0,0,0,0};
-        tmp[4] = crc[3];
-        if(crc[4] == 1)
-        {
-          if (q[i] == 1)
-          {
-            tmp[0] = 0;
-            tmp[1] = crc[0];
-            tmp[2] = crc[1];
-            tmp[3] = crc[2];
-          }
-          else
-          {
-            tmp[0] = 1;
-            tmp[1] = crc[0];
-            tmp[2] = crc[1];
-            if(crc[2] == 1)
-            {
-              tmp[3] = 0;
-            }
-            else
-            {
-              tmp[3] = 1;
-            }
-          }
-        }
-        else
-        {
-          if (q[i] == 1)
-          {
-            tmp[0] = 1;
-            tmp[1] = crc[0];
-            tmp[2] = crc[1];
-            if(crc[2] == 1)
-            {
-              tmp[3] = 0;
-            }
-            else
-            {
-              tmp[3] = 1;
-            }
-          }
-          else
-          {
-            tmp[0] = 0;
-            tmp[1] = crc[0];
-            tmp[2] = crc[1];
-            tmp[3] = crc[2];
-          }
-        }
-        memcpy(crc, tmp, 5*sizeof(float));
-      }
-      for (int i = 4; i >= 0; i--)
-        q.push_back(crc[i]);
-    }
   } /* namespace rfid */
 } /* namespace gr */
 
@@ -22,6 +22,8 @@
 #define INCLUDED_RFID_READER_IMPL_H
 
 #include <rfid/reader.h>
+#include "gen2_commands.h"
+#include "select_policy.h"
 #include <vector>
 #include <queue>
 #include <fstream>
@@ -32,17 +34,36 @@ namespace gr {
     {
      private:
       int s_rate, d_rate,  n_cwquery_s,  n_cwack_s,n_p_down_s;
-      float sample_d, n_data0_s, n_data1_s, n_cw_s, n_pw_s, n_delim_s, n_trcal_s;
-      std::vector<float> data_0, data_1, cw, cw_ack, cw_query, delim, frame_sync, preamble, rtcal, trcal, query_bits, ack_bits, query_rep,nak, query_adjust_bits,p_down;
+      float sample_d, n_cw_s;
+      std::vector<gr_complex> cw, cw_ack, cw_query, cw_select, cw_handle, cw_read, p_down;
+      pie_encoder pie;
+      gen2_bits query_bits, ack_bits, query_rep_bits, nak_bits, query_adjust_bits, select_bits, req_rn_bits, read_bits;
+      select_policy sel_policy;
+      std::vector<gen2_select> selects;
+      int select_index, query_sel;
+      bool selects_built;
+      // CW written up to a first decision point, then extended while IDLE : after ACK up to the
+      // PC word of the EPC reply, after Query/QueryRep up to the speculative empty slot decision
+      const std::vector<gr_complex> * cw_pending;   // NULL : nothing to extend
+      int n_cwack_header_s, n_cwquery_early_s, cw_written;
+      uint64_t cw_start_us;
+      int cw_ack_length(int reply_bits) const;
+      int write_cw(const std::vector<gr_complex> & cw_samples, int n_early, gr_complex * out);
+      int write_cw_query(gr_complex * out);
+      int extend_cw(gr_complex * out, int max_items);
       int q_change; // 0-> increment, 1-> unchanged, 2-> decrement
       void gen_query_adjust_bits();
-      void crc_append(std::vector<float> & q);
-      void gen_query_bits();
-      void gen_ack_bits(const float * in);
+      void gen_query_bits(int sel);
+      void gen_ack_bits(uint16_t rn16);
+      void gen_req_rn_bits();
+      void gen_read_bits();
+      void check_t2();
+      int render(const gen2_bits & bits, bool preamble, gr_complex * out);
 
     public:
       void print_results();
-      reader_impl(int sample_rate, int dac_rate);
+      std::string results();
+      reader_impl(int sample_rate, int dac_rate, float amplitude);
       ~reader_impl();
 
 
@@ -0,0 +1,67 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_SAMPLE_CLOCK_H
+#define INCLUDED_RFID_SAMPLE_CLOCK_H
+
+#include <stdint.h>
+
+namespace gr {
+  namespace rfid {
+
+    /*!
+     * \brief Time of the RX samples (us since the epoch), from their index.
+     *
+     * The clock is anchored on the rx_time tags of the USRP source (UHD time, GPS/PPS
+     * disciplined if the device is), or once on the host clock at the first sample when
+     * the source has no tags. Between two anchors time only advances with the sample
+     * count, so it is monotonic and sample accurate, and costs a multiply and a divide.
+     */
+    class sample_clock
+    {
+      public:
+        sample_clock(int sample_rate)
+          : d_rate(sample_rate), d_anchored(false), d_sample(0), d_time_us(0) {}
+
+        bool anchored() const { return d_anchored; }
+
+        void anchor(uint64_t sample, uint64_t time_us)
+        {
+          d_sample   = sample;
+          d_time_us  = time_us;
+          d_anchored = true;
+        }
+
+        uint64_t time_us(uint64_t sample) const
+        {
+          int64_t delta = int64_t(sample - d_sample) * 1000000 / d_rate;
+          return d_time_us + delta;
+        }
+
+      private:
+        int64_t d_rate;
+        bool d_anchored;
+        uint64_t d_sample, d_time_us;
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_SAMPLE_CLOCK_H */
@@ -0,0 +1,56 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "select_policy.h"
+#include <boost/static_assert.hpp>
+
+namespace gr {
+  namespace rfid {
+
+    // S0 flags decay as soon as the Tag loses power, S1 flags within milliseconds
+    BOOST_STATIC_ASSERT(!SELECT_FILTER || QUERY_SESSION >= 2);
+
+    int select_policy::build(std::vector<gen2_select> & selects)
+    {
+      selects.resize(0);
+
+      // The first round also starts from a known state
+      if (d_rounds++ % SELECT_REFRESH_ROUNDS == 0)
+      {
+        gen2_select select;
+        select.target   = QUERY_SESSION;
+        // Matching -> Query target, non-matching -> other target (the empty mask matches every Tag)
+        select.action   = TARGET ? 4 : 0;
+        select.membank  = MEMBANK_EPC;
+        select.pointer  = 0;
+        select.truncate = 0;
+        select.mask.clear();
+        selects.push_back(select);
+      }
+
+      return SEL[0]*2 + SEL[1];
+    }
+
+  } /* namespace rfid */
+} /* namespace gr */
@@ -0,0 +1,55 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2015 <Nikos Kargas (nkargas@isc.tuc.gr)>.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_RFID_SELECT_POLICY_H
+#define INCLUDED_RFID_SELECT_POLICY_H
+
+#include "gen2_commands.h"
+#include "rfid/global_vars.h"
+#include <vector>
+
+namespace gr {
+  namespace rfid {
+
+    /*!
+     * \brief Builds the Select commands sent at the beginning of an inventory round.
+     *
+     * Known Tags are suppressed by their inventoried flag in a persistent session (S2/S3):
+     * a Tag that is read with target A moves to B and keeps it across rounds, so it does not
+     * take part in the next rounds and no per Tag Select is needed. Every SELECT_REFRESH_ROUNDS
+     * rounds a single Select with an empty mask moves all Tags back to the Query target, so
+     * that the presence of known Tags is verified.
+     */
+    class select_policy
+    {
+      public:
+        select_policy() : d_rounds(0) {}
+
+        // Returns the Sel field of the Query that follows the Select commands
+        int build(std::vector<gen2_select> & selects);
+
+      private:
+        int d_rounds;
+    };
+
+  } // namespace rfid
+} // namespace gr
+
+#endif /* INCLUDED_RFID_SELECT_POLICY_H */
@@ -26,8 +26,12 @@
 #include <gnuradio/prefs.h>
 #include <gnuradio/math.h>
 #include <cmath>
-#include <sys/time.h>
 #include "tag_decoder_impl.h"
+#include "metrics.h"
+#include "burst_capture.h"
+#include "burst_arena.h"
+#include "deploy_profile.h"
+#include "fast_math.h"
 
 namespace gr {
   namespace rfid {
@@ -37,7 +41,7 @@ namespace gr {
     {
 
       std::vector<int> output_sizes;
-      output_sizes.push_back(sizeof(float));
+      output_sizes.push_back(sizeof(uint16_t));   // RN16 of the slot
       output_sizes.push_back(sizeof(gr_complex));
 
       return gnuradio::get_initial_sptr
@@ -49,16 +53,32 @@ namespace gr {
      */
     tag_decoder_impl::tag_decoder_impl(int sample_rate, std::vector<int> output_sizes)
       : gr::block("tag_decoder",
-              gr::io_signature::make(1, 1, sizeof(gr_complex)),
+              gr::io_signature::make(1, 1, sizeof(int)),
               gr::io_signature::makev(2, 2, output_sizes )),
-              s_rate(sample_rate)
+              s_rate(sample_rate), slot_collision(false), d_deferred(EPC_WORKER && !ACCESS_READ),
+              d_jobs_pending(0), d_stop(false), d_reads_port(pmt::mp("reads"))
     {
+      // One message per correct EPC : EPC, antenna, RX time, amplitude and phase
+      message_port_register_out(d_reads_port);
 
 
-      char_bits = (char *) malloc( sizeof(char) * 128);
-
       n_samples_TAG_BIT = TAG_BIT_D * s_rate / pow(10,6);      
+      fast_ch.h_slot_valid = false;
+      fast_ch.T = n_samples_TAG_BIT / 2;   // Nominal until the first EPC
+      fast_ch.antenna = 0;
+      fast_ch.time_us = 0;
       GR_LOG_INFO(d_logger, "Number of samples of Tag bit : "<< n_samples_TAG_BIT);
+
+      // Picked once for the sample rate, for the longest EPC or Read reply
+      d_kernel = make_fm0_kernel(n_samples_TAG_BIT / 2, 2 * std::max(EPC_MAX_REPLY_BITS, READ_REPLY_BITS + 16 * ACCESS_MAX_WORDS));
+      GR_LOG_INFO(d_logger, "FM0 kernel : " << d_kernel->name());
+
+      // One item per burst
+      if (DEPLOY_PROFILE)
+        deploy_block(*this, DEPLOY_DECODER, 0, BURST_ARENA_SLOTS);
+
+      if (d_deferred)
+        d_worker = boost::thread(&tag_decoder_impl::worker, this);
     }
 
     /*
@@ -66,32 +86,44 @@ namespace gr {
      */
     tag_decoder_impl::~tag_decoder_impl()
     {
-
+      if (d_deferred)
+      {
+        d_stop = true;
+        d_worker.join();
+      }
+      delete d_kernel;
     }
 
     void
     tag_decoder_impl::forecast (int noutput_items, gr_vector_int &ninput_items_required)
     {
-        ninput_items_required[0] = noutput_items;
+        // At least one burst (slot of the burst arena) per call
+        ninput_items_required[0] = 1;
     }
 
-    int tag_decoder_impl::tag_sync(const gr_complex * in , int size)
+    int tag_decoder_impl::tag_sync(const gr_complex * in , int size, reply_channel & ch, int exclude_index)
     {
       int max_index = 0;
       float max = 0,corr;
-      gr_complex corr2;
-      
+
       // Do not have to check entire vector (not optimal)
-      for (int i=0; i < 1.5 * n_samples_TAG_BIT ; i++)
+      int n_candidates = (int) std::ceil(1.5 * n_samples_TAG_BIT);
+      std::vector<gr_complex> corr2(n_candidates);
+
+      // sync after matched filter (equivalent)
+      d_kernel->preamble(in, n_candidates, &corr2[0]);
+
+      for (int i=0; i < n_candidates ; i++)
       {
-        corr2 = gr_complex(0,0);
-        corr = 0;
-        // sync after matched filter (equivalent)
-        for (int j = 0; j < 2 * TAG_PREAMBLE_BITS; j ++)
-        {
-          corr2 = corr2 + in[ (int) (i+j*n_samples_TAG_BIT/2) ] * gr_complex(TAG_PREAMBLE[j],0);
-        }
-        corr = std::norm(corr2);
+        // Skip the timing of a Tag that has already been detected (collision recovery)
+        if (exclude_index >= 0 && std::abs(i + TAG_PREAMBLE_BITS * n_samples_TAG_BIT + n_samples_TAG_BIT/2 - exclude_index) < n_samples_TAG_BIT/4)
+          continue;
+
+        // Coherent correlation if the channel of the Tag is already known (EPC after RN16)
+        if (ch.h_slot_valid)
+          corr = std::real(corr2[i] * std::conj(ch.h_slot));
+        else
+          corr = std::norm(corr2[i]);
         if (corr > max)
         {
           max = corr;
@@ -99,9 +131,12 @@ namespace gr {
         }
       }  
 
-       // Preamble ({1,1,-1,1,-1,-1,1,-1,-1,-1,1,1} 1 2 4 7 11 12)) 
-      h_est = (in[max_index] + in[ (int) (max_index + n_samples_TAG_BIT/2) ] + in[ (int) (max_index + 3*n_samples_TAG_BIT/2) ] + in[ (int) (max_index + 6*n_samples_TAG_BIT/2)] + in[(int) (max_index + 10*n_samples_TAG_BIT/2) ] + in[ (int) (max_index + 11*n_samples_TAG_BIT/2)])/std::complex<float>(6,0);  
+       // Preamble ({1,1,-1,1,-1,-1,1,-1,-1,-1,1,1} 1 2 4 7 11 12)), mean of the 6 samples at level 1
+      ch.h_est = corr2[max_index]/std::complex<float>(6,0);  
 
+      // Combine the 6 preamble samples with the 2*16 RN16 samples of the same slot
+      if (ch.h_slot_valid)
+        ch.h_est = (float(6) * ch.h_est + float(2*(RN16_BITS-1)) * ch.h_slot) / float(6 + 2*(RN16_BITS-1));
 
       // Shifted received waveform by n_samples_TAG_BIT/2
       max_index = max_index + TAG_PREAMBLE_BITS * n_samples_TAG_BIT + n_samples_TAG_BIT/2; 
@@ -111,16 +146,119 @@ namespace gr {
 
 
 
-    std::vector<float>  tag_decoder_impl::tag_detection_RN16(std::vector<gr_complex> & RN16_samples_complex)
+    int tag_decoder_impl::sample_half_bits(const gr_complex * in, int size, int index, int n_half_bits, std::vector<gr_complex> & samples)
+    {
+      samples.resize(n_half_bits);
+      int number_of_half_bits = d_kernel->half_bits(in, size, index, n_half_bits, &samples[0]);
+      samples.resize(number_of_half_bits);
+      return number_of_half_bits;
+    }
+
+
+    void tag_decoder_impl::cancel_tag(std::vector<gr_complex> & samples, int index, gr_complex h, const epc_bits & bits)
+    {
+      // Half bit grid of the Tag : 12 preamble half bits, one unused half bit, 2 half bits per data bit
+      std::vector<float> levels;
+      for (int k = 0; k < 2 * TAG_PREAMBLE_BITS; k++)
+        levels.push_back(TAG_PREAMBLE[k] == 1 ? 1 : -1);
+      levels.push_back(0);
+
+      // Invert the differential decoder (each pair of samples is +/- level)
+      int level = 1;
+      for (int j = 0; j < bits.size(); j++)
+      {
+        if (bits[j] == 1)
+          level = -level;
+        levels.push_back(level);
+        levels.push_back(-level);
+      }
+
+      float half_bit = n_samples_TAG_BIT/2;
+      for (int k = 0; k < levels.size(); k++)
+      {
+        float pos = index + (k - 2 * TAG_PREAMBLE_BITS - 1) * half_bit;
+        int start = std::max(0, (int) std::ceil(pos - half_bit/2));
+        int end   = std::min((int) samples.size(), (int) std::ceil(pos + half_bit/2));
+        for (int n = start; n < end; n++)
+          samples[n] -= levels[k] * h;
+      }
+    }
+
+
+    bool tag_decoder_impl::collision_recovery(const gr_complex * in, int size, int RN16_index, epc_bits & RN16_bits, reply_channel & ch)
+    {
+      std::vector<gr_complex> residual(in, in + size), samples;
+      epc_bits bits_a = RN16_bits, bits_b;
+      gr_complex h_a = ch.h_refined, h_b;
+      int index_a = RN16_index, index_b;
+      float energy_total = 0, energy_residual = 0;
+
+      // Remove the strongest Tag and check if a second reply remains
+      cancel_tag(residual, index_a, h_a, bits_a);
+      for (int n = 0; n < size; n++)
+      {
+        energy_total    += std::norm(in[n]);
+        energy_residual += std::norm(residual[n]);
+      }
+      if (energy_residual < COLLISION_RESIDUAL_THRESH * energy_total)
+        return false;
+
+      GR_LOG_INFO(d_debug_logger, "RN16 COLLISION DETECTED");
+      reader_state->reader_stats.n_collisions++;
+      reader_state->metrics->add(METRIC_COLLISIONS);
+
+      for (int iter = 0; iter < SIC_ITERATIONS; iter++)
+      {
+        // Second Tag from the residual
+        index_b = tag_sync(&residual[0], size, ch, index_a);
+        if (sample_half_bits(&residual[0], size, index_b, 2*(RN16_BITS-1), samples) != 2*(RN16_BITS-1))
+          return false;
+        bits_b = tag_detection_RN16(samples, ch);
+        h_b = ch.h_refined;
+
+        // First Tag again, with the second one cancelled
+        residual.assign(in, in + size);
+        cancel_tag(residual, index_b, h_b, bits_b);
+        index_a = tag_sync(&residual[0], size, ch, index_b);
+        if (sample_half_bits(&residual[0], size, index_a, 2*(RN16_BITS-1), samples) != 2*(RN16_BITS-1))
+          return false;
+        bits_a = tag_detection_RN16(samples, ch);
+        h_a = ch.h_refined;
+
+        residual.assign(in, in + size);
+        cancel_tag(residual, index_a, h_a, bits_a);
+      }
+
+      // Only one Tag can be acknowledged, keep the strongest
+      if (std::abs(h_b) > std::abs(h_a))
+      {
+        RN16_bits = bits_b;
+        ch.h_refined = h_b;
+      }
+      else
+      {
+        RN16_bits = bits_a;
+        ch.h_refined = h_a;
+      }
+      return true;
+    }
+
+
+    epc_bits  tag_decoder_impl::tag_detection_RN16(std::vector<gr_complex> & RN16_samples_complex, reply_channel & ch)
     {
       // detection + differential decoder (since Tag uses FM0)
-      std::vector<float> tag_bits,dist;
+      epc_bits tag_bits;
       float result;
       int prev = 1,index_T=0;
+      gr_complex diff, h_sum(0,0);
       
       for (int j = 0; j < RN16_samples_complex.size()/2 ; j ++ )
       {
-        result = std::real( (RN16_samples_complex[2*j] - RN16_samples_complex[2*j+1])*std::conj(h_est)); 
+        diff = RN16_samples_complex[2*j] - RN16_samples_complex[2*j+1];
+        result = std::real(diff * std::conj(ch.h_est)); 
+
+        // Decision-directed channel estimate (each half bit is +/- h)
+        h_sum += (result > 0) ? diff : -diff;
   
         if (result>0){
           if (prev == 1)
@@ -138,40 +276,56 @@ namespace gr {
           prev = -1;    
         }
       }
+      if (RN16_samples_complex.size() > 0)
+        ch.h_refined = h_sum / float(RN16_samples_complex.size());
       return tag_bits;
     }
 
 
-    std::vector<float>  tag_decoder_impl::tag_detection_EPC(std::vector<gr_complex> & EPC_samples_complex, int index)
+    epc_bits  tag_decoder_impl::tag_detection_EPC(const gr_complex * EPC_samples_complex, int size, int index, reply_channel & ch)
     {
-      std::vector<float> tag_bits,dist;
+      epc_bits tag_bits;
       float result=0;
       int prev = 1;
       
       int number_steps = 20;
       float min_val = n_samples_TAG_BIT/2.0 -  n_samples_TAG_BIT/2.0/100, max_val = n_samples_TAG_BIT/2.0 +  n_samples_TAG_BIT/2.0/100;
 
+      // Half bits in the burst at the longest T, the gate has ungated the length announced by the PC
+      int n_half_bits = std::min(2 * (EPC_MAX_REPLY_BITS - 1), (int) ((size - 1 - index) / max_val) + 1);
+      if (n_half_bits < 2)
+        return tag_bits;
+
       std::vector<float> energy;
 
       energy.resize(number_steps);
       for (int t = 0; t <number_steps; t++)
-      {  
-        for (int i =0; i <256; i++)
-        {
-          energy[t]+= reader_state->magn_squared_samples[(int) (i * (min_val + t*(max_val-min_val)/(number_steps-1)) + index)];
-        }
-
-      }
+        energy[t] = fm0_kernel::energy(EPC_samples_complex, index, min_val + t*(max_val-min_val)/(number_steps-1), std::min(256, n_half_bits));
       int index_T = std::distance(energy.begin(), std::max_element(energy.begin(), energy.end()));
       float T =  min_val + index_T*(max_val-min_val)/(number_steps-1);
 
       // T estimated
-      T_global = T;
-  
-      for (int j = 0; j < 128 ; j ++ )
+      ch.T = T;
+
+      // Half bits in the burst at the estimated T (the longest T would cut the end of long replies),
+      // one sample is kept for the rounding of the resampler
+      n_half_bits = std::min(2 * (EPC_MAX_REPLY_BITS - 1), (int) ((size - 2 - index) / T) + 1);
+
+      gr_complex diff, h_track = ch.h_est, h_sum(0,0);
+      gr_complex half_bits[2 * (EPC_MAX_REPLY_BITS - 1)];
+      fm0_kernel::resample(EPC_samples_complex, index, T, n_half_bits, half_bits);
+
+      // PC first, then the length it announces
+      int n_bits = std::min(16, n_half_bits / 2);
+      for (int j = 0; j < n_bits ; j ++ )
       {
-        result = std::real((EPC_samples_complex[ (int) (j*(2*T) + index) ] - EPC_samples_complex[ (int) (j*2*T + T + index) ])*std::conj(h_est) ); 
+        diff = half_bits[2*j] - half_bits[2*j+1];
+        result = std::real(diff * std::conj(h_track)); 
 
+        // Decision-directed tracking of ch.h_est along the EPC
+        diff = (result > 0) ? diff/float(2) : -diff/float(2);
+        h_track += CHANNEL_TRACK_MU * (diff - h_track);
+        h_sum += diff;
         
          if (result>0){
           if (prev == 1)
@@ -188,44 +342,446 @@ namespace gr {
             tag_bits.push_back(1);      
           prev = -1;    
         }
+
+        // XPC_W1 is needed too if XI is set
+        if (tag_bits.size() == 16 || (tag_bits.size() == 32 && tag_bits.xpc_words() > 0))
+          n_bits = std::min(tag_bits.reply_bits(), n_half_bits / 2);
       }
+      ch.h_refined = h_sum / float(n_bits);
       return tag_bits;
     }
 
 
-    int
-    tag_decoder_impl::general_work (int noutput_items,
-                       gr_vector_int &ninput_items,
-                       gr_vector_const_void_star &input_items,
-                       gr_vector_void_star &output_items)
+    bool tag_decoder_impl::empty_slot(const std::vector<gr_complex> & RN16_samples_complex, const reply_channel & ch)
     {
+      // Without a reply the decision-directed estimate only collects noise
+      float energy = 0;
+      for (int j = 0; j < RN16_samples_complex.size(); j++)
+        energy += std::norm(RN16_samples_complex[j]);
+      energy /= RN16_samples_complex.size();
+
+      return std::norm(ch.h_refined) < EMPTY_SLOT_RATIO * energy;
+    }
 
 
-      const gr_complex *in = (const  gr_complex *) input_items[0];
-      float *out = (float *) output_items[0];
-      gr_complex *out_2 = (gr_complex *) output_items[1]; // for debugging
-      
-      int written_sync =0;
-      int written = 0, consumed = 0;
-      int RN16_index , EPC_index;
+    void tag_decoder_impl::update_channel_cache(const epc_bits & epc, const reply_channel & ch, float ampl, float phase)
+    {
+      std::pair<epc_bits,int> key(epc, ch.antenna);
+      std::map<std::pair<epc_bits,int>, TAG_CHANNEL>::iterator it = reader_state->reader_stats.tag_channels.find(key);
+
+      if (it == reader_state->reader_stats.tag_channels.end())
+      {
+        TAG_CHANNEL channel;
+        channel.h          = ch.h_refined;
+        channel.h_avg      = ch.h_refined;
+        channel.ampl_avg   = ampl;
+        channel.n_reads    = 0;
+        channel.phase_head = 0;
+        it = reader_state->reader_stats.tag_channels.insert(std::make_pair(key, channel)).first;
+      }
+      else
+      {
+        TAG_CHANNEL & channel = it->second;
+        channel.h        = ch.h_refined;
+        channel.h_avg    += CHANNEL_AVG_ALPHA * (ch.h_refined - channel.h_avg);
+        channel.ampl_avg += CHANNEL_AVG_ALPHA * (ampl - channel.ampl_avg);
+      }
+
+      // Phase history, the n_reads % PHASE_HISTORY last reads
+      TAG_CHANNEL & channel = it->second;
+      channel.phase_hist[channel.phase_head]    = phase;
+      channel.phase_time_us[channel.phase_head] = ch.time_us;
+      channel.phase_head = (channel.phase_head + 1) % PHASE_HISTORY;
+      channel.n_reads++;
+    }
+
+
+    void tag_decoder_impl::channel_prior(reply_channel & ch)
+    {
+      if (ch.h_slot_valid)
+        return;
+
+      // Singulated Tag : last channel of its EPC on this antenna seeds the sync of the access reply
+      boost::mutex::scoped_lock lock(reader_state->inventory_mutex);
+      std::map<std::pair<epc_bits,int>, TAG_CHANNEL>::const_iterator it =
+        reader_state->reader_stats.tag_channels.find(std::make_pair(reader_state->access.epc, reader_state->cur_antenna.load()));
+      if (it == reader_state->reader_stats.tag_channels.end())
+        return;
+
+      ch.h_slot       = it->second.h;
+      ch.h_slot_valid = true;
+    }
+
+
+    void tag_decoder_impl::journal_read(JOURNAL_RECORD_TYPE type, const epc_bits & bits, const reply_channel & ch)
+    {
+      if (reader_state->journal == NULL)
+        return;
+
+      journal_record record = journal_record();
+      record.type    = type;
+      record.antenna = ch.antenna;
+      record.ampl    = fast_abs(ch.h_refined);
+      record.phase   = fast_arg(ch.h_refined);
+      record.count   = 1;
+      record.time_us = ch.time_us;
+      record.set_bits(bits);
+
+      // Sequence of the EPC record is written by the EPC worker when it is enabled
+      boost::mutex::scoped_lock lock(reader_state->inventory_mutex);
+      if (type == JOURNAL_MEM)
+      {
+        record.ref = reader_state->access.journal_seq;
+        record.op  = reader_state->access.op;
+      }
+
+      // Queued only, committed by the journal thread
+      reader_state->journal->append(record);
+      if (type == JOURNAL_EPC)
+        reader_state->access.journal_seq = record.seq;
+    }
+
+    void tag_decoder_impl::publish_read(const epc_bits & epc, const reply_channel & ch, int round, const float * ampl, const float * phase)
+    {
+      // Index 0 : channel estimate of the preamble, 1 : refined over the whole reply
+      pmt::pmt_t read = pmt::make_dict();
+      read = pmt::dict_add(read, pmt::mp("epc"), pmt::mp(epc.to_hex()));
+      read = pmt::dict_add(read, pmt::mp("antenna"), pmt::from_long(ch.antenna));
+      read = pmt::dict_add(read, pmt::mp("round"), pmt::from_long(round));
+      read = pmt::dict_add(read, pmt::mp("time_us"), pmt::from_uint64(ch.time_us));
+      read = pmt::dict_add(read, pmt::mp("ampl"), pmt::from_double(ampl[0]));
+      read = pmt::dict_add(read, pmt::mp("phase"), pmt::from_double(phase[0]));
+      read = pmt::dict_add(read, pmt::mp("ampl_refined"), pmt::from_double(ampl[1]));
+      read = pmt::dict_add(read, pmt::mp("phase_refined"), pmt::from_double(phase[1]));
+      message_port_pub(d_reads_port, read);
+    }
+
+    bool tag_decoder_impl::stop()
+    {
+      // EPCs still queued are part of the run
+      while (d_jobs_pending.load(boost::memory_order_acquire) > 0)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+
+      if (reader_state->journal != NULL)
+        reader_state->journal->sync();
+      return true;
+    }
+
+
+    bool tag_decoder_impl::decode_reply(const gr_complex * in, int size, int n_bits, epc_bits & bits, reply_channel & ch)
+    {
+      // FM0 reply of known length (access phase)
+      std::vector<gr_complex> samples;
+      int index = tag_sync(in, size, ch);
+
+      if (sample_half_bits(in, size, index, 2 * n_bits, samples) != 2 * n_bits)
+        return false;
+      bits = tag_detection_RN16(samples, ch);
+      return true;
+    }
+
+
+    CAPTURE_OUTCOME tag_decoder_impl::decode_epc(const gr_complex * in, int size, reply_channel & ch, bool collision, int round, epc_bits & epc)
+    {
+      int EPC_index = tag_sync(in, size, ch);
+      epc_bits EPC_bits = tag_detection_EPC(in, size, EPC_index, ch);
+
+      // Shorter than announced by its PC
+      if (EPC_bits.size() < 32 || EPC_bits.size() != EPC_bits.reply_bits())
+      {
+        GR_LOG_INFO(d_debug_logger, "EPC REPLY TRUNCATED");
+        return CAPTURE_EPC_FAIL;
+      }
+      if (!EPC_bits.check_crc())
+      {
+        //After EPC message send a query rep or query (NAK is not sent)
+        GR_LOG_INFO(d_debug_logger, "EPC FAIL TO DECODE");
+        reader_state->metrics->add(METRIC_EPC_CRC_FAIL);
+        return CAPTURE_EPC_FAIL;
+      }
+
+      reader_state->metrics->add(METRIC_EPC_CORRECT);
+
+      epc = EPC_bits.epc();
+      // Amplitude and phase of the preamble and of the refined estimate, once per read
+      gr_complex h[2] = {ch.h_est, ch.h_refined};
+      float ampl[2], phase[2];
+      fast_abs_arg(h, ampl, phase, 2);
+      GR_LOG_INFO(d_debug_logger, "EPC CORRECTLY DECODED, EPC : " << epc.to_hex() << " AMPLITUDE : " << ampl[1] << " PHASE : " << phase[1]);
 
-      std::vector<float> RN16_samples_real;
-      std::vector<float> EPC_samples_real;
+      {
+        // Counters and inventory are shared with results() and the scheduler thread
+        boost::mutex::scoped_lock lock(reader_state->inventory_mutex);
+        reader_state->reader_stats.n_epc_correct+=1;
+        reader_state->reader_stats.epc_airtime_us += (TAG_PREAMBLE_BITS + EPC_bits.size() + 1) * TAG_BIT_D;
+        if (collision)
+          reader_state->reader_stats.n_collisions_recovered++;
+
+        update_channel_cache(epc, ch, ampl[1], phase[1]);
+
+        // Save Tag's EPC + number of reads
+        if (++reader_state->reader_stats.tag_reads[epc] == 1)
+          reader_state->reader_stats.n_unique_tags++;
+        reader_state->reader_stats.tags_cur_round.insert(epc);
+        touch_tag(epc, round);
+        update_read_times(epc, ch.time_us);
+        if (reader_state->reader_stats.tag_reads.size() > MAX_TRACKED_TAGS)
+          evict_tag();
+      }
+
+      journal_read(JOURNAL_EPC, epc, ch);
+      publish_read(epc, ch, round, ampl, phase);
+      return CAPTURE_EPC;
+    }
+
+
+    void tag_decoder_impl::capture_burst(int slot, CAPTURE_OUTCOME outcome, const reply_channel & ch, int round, int slot_number)
+    {
+      if (reader_state->capture == NULL || !reader_state->capture->wanted(outcome))
+        return;
+
+      capture_meta meta;
+      meta.outcome = outcome;
+      meta.round   = round;
+      meta.slot    = slot_number;
+      meta.h_est   = ch.h_refined;
+      meta.t_est   = ch.T;
+      meta.time_us = ch.time_us;
+      reader_state->capture->record(slot, reader_state->bursts->samples(slot), reader_state->bursts->length(slot), meta);
+    }
+
+
+    void tag_decoder_impl::push_job(const epc_job & job)
+    {
+      d_jobs_pending.fetch_add(1, boost::memory_order_relaxed);
+      // Only waits if the worker is a whole queue behind
+      while (!d_jobs.push(job))
+        boost::this_thread::yield();
+    }
+
+
+    void tag_decoder_impl::worker()
+    {
+      epc_job job;
+
+      while (true)
+      {
+        if (!d_jobs.pop(job))
+        {
+          if (d_stop)
+            return;
+          boost::this_thread::sleep(boost::posix_time::microseconds(EPC_WORKER_POLL_US));
+          continue;
+        }
+
+        if (job.type == EPC_JOB_END_OF_ROUND)
+          end_of_round();
+        else
+        {
+          epc_bits epc;
+          CAPTURE_OUTCOME outcome = decode_epc(reader_state->bursts->samples(job.slot), reader_state->bursts->length(job.slot),
+                                               job.ch, job.collision, job.round, epc);
+          capture_burst(job.slot, outcome, job.ch, job.round, job.slot_number);
+          reader_state->bursts->release(job.slot);
+        }
+        d_jobs_pending.fetch_sub(1, boost::memory_order_release);
+      }
+    }
+
+
+    MAC_COMMAND tag_decoder_impl::mac_event(MAC_EVENT event)
+    {
+      gen2_mac & mac = *reader_state->mac;
+      int target = mac.target();
+
+      // Next command of the reader
+      MAC_COMMAND command = mac.handle(event);
+      switch (command)
+      {
+        case MAC_CMD_QUERY:
+          //if (P_DOWN == true)
+          //  reader_state->gen2_logic_status = POWER_DOWN;
+          //else
+            reader_state->gen2_logic_status = SEND_QUERY;
+          break;
+        case MAC_CMD_QUERY_REP:
+          reader_state->gen2_logic_status = SEND_QUERY_REP;
+          break;
+        case MAC_CMD_ACK:
+          reader_state->gen2_logic_status = SEND_ACK;
+          break;
+        case MAC_CMD_REQ_RN:
+          reader_state->gen2_logic_status = SEND_REQ_RN;
+          break;
+        case MAC_CMD_READ:
+          reader_state->gen2_logic_status = SEND_READ;
+          break;
+        default:
+          GR_LOG_WARN(d_logger, "Unexpected event " << event << " in MAC state " << mac.state());
+          break;
+      }
+
+      if (mac.round_ended())
+      {
+        // After the EPCs of the round that are still queued
+        if (d_deferred)
+        {
+          epc_job job;
+          job.type = EPC_JOB_END_OF_ROUND;
+          push_job(job);
+        }
+        else
+          end_of_round();
+      }
+      if (mac.target() != target)
+        GR_LOG_INFO(d_debug_logger, "TARGET FLIPPED TO " << (mac.target() ? "B" : "A"));
+
+      // Shared state read by the other blocks
+      reader_state->reader_stats.cur_slot_number     = mac.slot();
+      reader_state->reader_stats.cur_inventory_round = mac.round();
+      reader_state->reader_stats.max_slot_number     = mac.max_slot();
+      reader_state->cur_target = mac.target();
+      reader_state->access.op  = mac.access_op();
+      return command;
+    }
+
+
+    void tag_decoder_impl::end_of_round()
+    {
+      READER_STATS & stats = reader_state->reader_stats;
+      boost::mutex::scoped_lock lock(reader_state->inventory_mutex);
+
+      // Unique Tags read in the round, only the last ROUND_HISTORY rounds are kept
+      stats.unique_tags_round.push_back(stats.tags_cur_round.size());
+      if (stats.unique_tags_round.size() > ROUND_HISTORY)
+        stats.unique_tags_round.pop_front();
+
+      stats.tags_cur_round.clear();
+    }
+
+
+    void tag_decoder_impl::touch_tag(const epc_bits & epc, int round)
+    {
+      READER_STATS & stats = reader_state->reader_stats;
+
+      std::pair<std::map<epc_bits,int>::iterator, bool> last = stats.tag_last_round.insert(std::make_pair(epc, round));
+      if (!last.second)
+      {
+        if (last.first->second == round)
+          return;
+        std::map<int, std::set<epc_bits> >::iterator prev = stats.tags_by_round.find(last.first->second);
+        prev->second.erase(epc);
+        if (prev->second.empty())
+          stats.tags_by_round.erase(prev);
+        last.first->second = round;
+      }
+      stats.tags_by_round[round].insert(epc);
+    }
+
+    void tag_decoder_impl::evict_tag()
+    {
+      READER_STATS & stats = reader_state->reader_stats;
+
+      // Least recently read Tag
+      std::map<int, std::set<epc_bits> >::iterator oldest = stats.tags_by_round.begin();
+      epc_bits epc = *oldest->second.begin();
+
+      oldest->second.erase(oldest->second.begin());
+      if (oldest->second.empty())
+        stats.tags_by_round.erase(oldest);
+      stats.tag_last_round.erase(epc);
+      stats.tag_reads.erase(epc);
+      stats.n_unique_tags--;
+
+      std::map<std::pair<epc_bits,int>, TAG_CHANNEL>::iterator it_ch = stats.tag_channels.lower_bound(std::make_pair(epc, 0));
+      while (it_ch != stats.tag_channels.end() && it_ch->first.first == epc)
+        stats.tag_channels.erase(it_ch++);
+      stats.tag_times.erase(epc);
+
+      std::map<std::pair<epc_bits,int>, epc_bits>::iterator it_mem = stats.tag_memory.lower_bound(std::make_pair(epc, 0));
+      while (it_mem != stats.tag_memory.end() && it_mem->first.first == epc)
+        stats.tag_memory.erase(it_mem++);
+    }
+
+    void tag_decoder_impl::update_read_times(const epc_bits & epc, uint64_t time_us)
+    {
+      TAG_TIMES & times = reader_state->reader_stats.tag_times[epc];
+
+      if (times.n_reads == 0)
+        times.first_us = time_us;
+      else
+      {
+        uint64_t interval = time_us - times.last_us;
+        times.interval_sum_us += interval;
+        times.interval_max_us  = std::max(times.interval_max_us, interval);
+        times.interval_min_us  = (times.n_reads == 1) ? interval : std::min(times.interval_min_us, interval);
+      }
+      times.last_us = time_us;
+      times.n_reads++;
+    }
+
+
+    int tag_decoder_impl::decode_burst(int slot, uint16_t * out)
+    {
+      int written = 0;
+      int RN16_index;
 
       std::vector<gr_complex> RN16_samples_complex;
-      std::vector<gr_complex> EPC_samples_complex;
 
-      std::vector<float> RN16_bits;
+      epc_bits RN16_bits;
       int number_of_half_bits = 0;
 
-      std::vector<float> EPC_bits;    
-      // Processing only after n_samples_to_ungate are available and we need to decode an RN16
-      if (reader_state->decoder_status == DECODER_DECODE_RN16 && ninput_items[0] >= reader_state->n_samples_to_ungate)
+      epc_bits reply;
+
+      reply_channel & ch = fast_ch;
+
+      // Samples of the Tag reply are read in place from the burst arena
+      const gr_complex *in = reader_state->bursts->samples(slot);
+      int n_burst = reader_state->bursts->length(slot);
+      ch.time_us  = reader_state->bursts->time_us(slot);
+
+      // Slot of the burst, before the MAC moves on
+      CAPTURE_OUTCOME outcome = CAPTURE_NO_REPLY;
+      int capture_round = reader_state->reader_stats.cur_inventory_round;
+      int capture_slot  = reader_state->reader_stats.cur_slot_number;
+
+      // No window, the gate never saw the command (lost) : the MAC moves on as without a reply
+      if (n_burst == 0)
+      {
+        GR_LOG_INFO(d_debug_logger, "NO REPLY WINDOW (LOST COMMAND)");
+        ch.h_slot_valid = false;
+        slot_collision = false;
+        mac_event(MAC_EV_NO_REPLY);
+        reader_state->bursts->release(slot);
+        return 0;
+      }
+
+      // Empty for the gate : no sync or decoding, the reader sends the next QueryRep right away
+      if (reader_state->decoder_status == DECODER_DECODE_RN16 && reader_state->bursts->empty(slot))
+      {
+        GR_LOG_INFO(d_debug_logger, "EMPTY SLOT (GATE)");
+        ch.h_slot_valid = false;
+        slot_collision = false;
+        reader_state->metrics->add(METRIC_SLOTS);
+        reader_state->metrics->add(METRIC_EMPTY_SLOTS);
+        reader_state->metrics->add(METRIC_SPECULATIVE_EMPTY);
+        mac_event(MAC_EV_NO_REPLY);
+        capture_burst(slot, CAPTURE_EMPTY, ch, capture_round, capture_slot);
+        reader_state->bursts->release(slot);
+        return 0;
+      }
+
+      // Processing only after the gate has passed a burst and we need to decode an RN16
+      if (reader_state->decoder_status == DECODER_DECODE_RN16)
       {
-        RN16_index = tag_sync(in,ninput_items[0]);
+        // New slot, channel of the replying Tag is unknown
+        ch.h_slot_valid = false;
+        ch.antenna = reader_state->cur_antenna;
+        slot_collision = false;
+        RN16_index = tag_sync(in,n_burst,ch);
 
         /*
-        for (int j = 0; j < ninput_items[0]; j ++ )
+        for (int j = 0; j < n_burst; j ++ )
         {
           out_2[written_sync] = in[j];
            written_sync ++;
@@ -233,77 +789,60 @@ namespace gr {
         produce(1,written_sync);
         */
 
-
-        for (float j = RN16_index; j < ninput_items[0]; j += n_samples_TAG_BIT/2 )
-        {
-          number_of_half_bits++;
-          int k = round(j);
-          RN16_samples_complex.push_back(in[k]);
-
-          //out_2[written_sync] = in[j];
-           //written_sync ++;
-
-          if (number_of_half_bits == 2*(RN16_BITS-1))
-          {
-            //out_2[written_sync] = h_est;
-             //written_sync ++;  
-            //produce(1,written_sync);        
-            break;
-          }
-        }    
+        number_of_half_bits = sample_half_bits(in, n_burst, RN16_index, 2*(RN16_BITS-1), RN16_samples_complex);
 
         // RN16 bits are passed to the next block for the creation of ACK message
         if (number_of_half_bits == 2*(RN16_BITS-1))
         {  
           GR_LOG_INFO(d_debug_logger, "RN16 DECODED");
-          RN16_bits  = tag_detection_RN16(RN16_samples_complex);
-
-          for(int bit=0; bit<RN16_bits.size(); bit++)
-          {
-            out[written] =  RN16_bits[bit];
-            written ++;
-          }
-          produce(0,written);
-          reader_state->gen2_logic_status = SEND_ACK;
+          RN16_bits  = tag_detection_RN16(RN16_samples_complex, ch);
+
+          bool empty = empty_slot(RN16_samples_complex, ch);
+          reader_state->metrics->add(METRIC_SLOTS);
+          reader_state->metrics->add(empty ? METRIC_EMPTY_SLOTS : METRIC_RN16);
+
+          // Second Tag only behind a decoded one, never in the noise of an empty slot
+          if (COLLISION_RECOVERY && !empty)
+            slot_collision = collision_recovery(in, n_burst, RN16_index, RN16_bits, ch);
+          outcome = slot_collision ? CAPTURE_COLLISION : (empty ? CAPTURE_EMPTY : CAPTURE_RN16);
+
+          // Seed the sync of the EPC that follows in the same slot
+          ch.h_slot = ch.h_refined;
+          ch.h_slot_valid = true;
+
+          // RN16 is passed as one 16 bit item
+          reader_state->access.rn16 = RN16_bits.value(0, RN16_BITS - 1);
+          out[written] = reader_state->access.rn16;
+          written ++;
+          mac_event(MAC_EV_RN16);
         }
         else
         {  
-          reader_state->reader_stats.cur_slot_number++;
-          if(reader_state->reader_stats.cur_slot_number > reader_state->reader_stats.max_slot_number)
-          {
-            reader_state->reader_stats.cur_slot_number = 1;
-            reader_state->reader_stats.unique_tags_round.push_back(reader_state->reader_stats.tag_reads.size());
-
-            reader_state->reader_stats.cur_inventory_round += 1;
-    
-            //if (P_DOWN == true)
-            //  reader_state->gen2_logic_status = POWER_DOWN;
-            //else
-              reader_state->gen2_logic_status = SEND_QUERY;
-          }
-          else
-          {
-            reader_state->gen2_logic_status = SEND_QUERY_REP;
-          }
+          mac_event(MAC_EV_NO_REPLY);
         }
-        consumed = reader_state->n_samples_to_ungate;
       }
-      else if (reader_state->decoder_status == DECODER_DECODE_EPC && ninput_items[0] >= reader_state->n_samples_to_ungate )
+      else if (reader_state->decoder_status == DECODER_DECODE_EPC)
       {  
-
-        //After EPC message send a query rep or query
-        reader_state->reader_stats.cur_slot_number++;
-        
-        
-        EPC_index = tag_sync(in,ninput_items[0]);
-
-        for (int j = 0; j < ninput_items[0]; j++ )
+        if (d_deferred)
         {
-          EPC_samples_complex.push_back(in[j]);
+          // Validated by the worker, the reader goes on with the next slot right away
+          epc_job job;
+          job.type        = EPC_JOB_DECODE;
+          job.slot        = slot;
+          job.ch          = ch;
+          job.collision   = slot_collision;
+          job.round       = capture_round;
+          job.slot_number = capture_slot;
+          ch.h_slot_valid = false;
+          push_job(job);
+          mac_event(MAC_EV_EPC_DEFERRED);
+
+          // The worker releases the arena slot
+          return written;
         }
 
         /*
-        for (int j = 0; j < ninput_items[0] ; j ++ )
+        for (int j = 0; j < n_burst ; j ++ )
         {
           out_2[written_sync] = in[j];
            written_sync ++;          
@@ -311,137 +850,100 @@ namespace gr {
         produce(1,written_sync);
         */
 
-        EPC_bits   = tag_detection_EPC(EPC_samples_complex,EPC_index);
+        epc_bits epc;
+        outcome = decode_epc(in, n_burst, ch, slot_collision, capture_round, epc);
+        ch.h_slot_valid = false;
 
-        
-        if (EPC_bits.size() == EPC_BITS - 1)
+        if (outcome == CAPTURE_EPC)
         {
-          // float to char -> use Buettner's function
-          for (int i =0; i < 128; i ++)
-          {
-            if (EPC_bits[i] == 0)
-              char_bits[i] = '0';
-            else
-              char_bits[i] = '1';
-          }
-          if(check_crc(char_bits,128) == 1)
-          {
-
-            if(reader_state->reader_stats.cur_slot_number > reader_state->reader_stats.max_slot_number)
-            {
-              reader_state->reader_stats.cur_slot_number = 1;
-              reader_state->reader_stats.unique_tags_round.push_back(reader_state->reader_stats.tag_reads.size());
-        
-              reader_state->reader_stats.cur_inventory_round+=1;
-              //if (P_DOWN == true)
-              //  reader_state->gen2_logic_status = POWER_DOWN;
-              //else
-                reader_state->gen2_logic_status = SEND_QUERY;
-            }
-            else
-            {
-              reader_state->gen2_logic_status = SEND_QUERY_REP;
-            }
-
-            reader_state->reader_stats.n_epc_correct+=1;
-
-            int result = 0;
-            for(int i = 0 ; i < 8 ; ++i)
-            {
-              result += std::pow(2,7-i) * EPC_bits[104+i] ;
-            }
-            GR_LOG_INFO(d_debug_logger, "EPC CORRECTLY DECODED, TAG ID : " << result);
-
-            // Save part of Tag's EPC message (EPC[104:111] in decimal) + number of reads
-            std::map<int,int>::iterator it = reader_state->reader_stats.tag_reads.find(result);
-            if ( it != reader_state->reader_stats.tag_reads.end())
-            {
-              it->second ++;
-            }
-            else
-            {
-              reader_state->reader_stats.tag_reads[result]=1;
-            }
-          }
-          else
-          {     
-
-            if(reader_state->reader_stats.cur_slot_number > reader_state->reader_stats.max_slot_number)
-            {
-              reader_state->reader_stats.cur_slot_number = 1;
-              reader_state->reader_stats.cur_inventory_round+=1;
-              //if (P_DOWN == true)
-              //  reader_state->gen2_logic_status = POWER_DOWN;
-              //else
-              //  reader_state->gen2_logic_status = SEND_NAK_Q;
-                reader_state->gen2_logic_status = SEND_QUERY;
-            }
-            else
-            {
-                //reader_state->gen2_logic_status = SEND_NAK_QR;
-                reader_state->gen2_logic_status = SEND_QUERY_REP;
-            }
-
-            
-            GR_LOG_INFO(d_debug_logger, "EPC FAIL TO DECODE");  
-          }
+          // With an access phase the Tag stays singulated, its memory is read with the handle from Req_RN
+          reader_state->access.epc = epc;
+          ch.h_slot = ch.h_refined;
+          // The reader thread may already have moved gen2_logic_status on
+          ch.h_slot_valid = (mac_event(MAC_EV_EPC_OK) == MAC_CMD_REQ_RN);
         }
         else
-        {
-          GR_LOG_EMERG(d_debug_logger, "CHECK ME");  
-        }
-        consumed = reader_state->n_samples_to_ungate;
+          mac_event(MAC_EV_EPC_FAIL);
       }
-      consume_each(consumed);
-      return WORK_CALLED_PRODUCE;
-    }
-
-
-    /* Function adapted from https://www.cgran.org/wiki/Gen2 */
-    int tag_decoder_impl::check_crc(char * bits, int num_bits)
-    {
-      register unsigned short i, j;
-      register unsigned short crc_16, rcvd_crc;
-      unsigned char * data;
-      int num_bytes = num_bits / 8;
-      data = (unsigned char* )malloc(num_bytes );
-      int mask;
-
-      for(i = 0; i < num_bytes; i++)
+      else if (reader_state->decoder_status == DECODER_DECODE_HANDLE)
       {
-        mask = 0x80;
-        data[i] = 0;
-        for(j = 0; j < 8; j++)
+        channel_prior(ch);
+
+        // Handle + CRC16
+        if (decode_reply(in, n_burst, HANDLE_BITS - 1, reply, ch) && reply.check_crc())
         {
-          if (bits[(i * 8) + j] == '1'){
-          data[i] = data[i] | mask;
+          reader_state->access.handle = reply.value(0, 16);
+          reader_state->reader_stats.n_handles++;
+          outcome = CAPTURE_HANDLE;
+          GR_LOG_INFO(d_debug_logger, "HANDLE DECODED : " << std::hex << reader_state->access.handle << std::dec);
+          mac_event(MAC_EV_HANDLE_OK);
         }
-        mask = mask >> 1;
+        else
+        {
+          GR_LOG_INFO(d_debug_logger, "HANDLE FAIL TO DECODE");
+          ch.h_slot_valid = false;
+          outcome = CAPTURE_HANDLE_FAIL;
+          mac_event(MAC_EV_HANDLE_FAIL);
         }
       }
-      rcvd_crc = (data[num_bytes - 2] << 8) + data[num_bytes -1];
-
-      crc_16 = 0xFFFF; 
-      for (i=0; i < num_bytes - 2; i++)
+      else if (reader_state->decoder_status == DECODER_DECODE_READ)
       {
-        crc_16^=data[i] << 8;
-        for (j=0;j<8;j++)
+        ACCESS_STATE & access = reader_state->access;
+        int n_words = access_read_words(access.op);
+        channel_prior(ch);
+
+        // Header + Memory words + Handle + CRC16
+        bool decoded = decode_reply(in, n_burst, READ_REPLY_BITS - 1 + 16 * n_words, reply, ch);
+        if (decoded && reply[0] == 0 && reply.check_crc() && reply.value(1 + 16 * n_words, 16) == access.handle)
         {
-          if (crc_16&0x8000)
+          GR_LOG_INFO(d_debug_logger, "READ DECODED, BANK : " << ACCESS_OPS[access.op][0] << " DATA : " << reply.sub(1, 16 * n_words).to_hex());
           {
-            crc_16 <<= 1;
-            crc_16 ^= 0x1021;
+            boost::mutex::scoped_lock lock(reader_state->inventory_mutex);
+            reader_state->reader_stats.tag_memory[std::make_pair(access.epc, access.op.load())] = reply.sub(1, 16 * n_words);
           }
-          else
-            crc_16 <<= 1;
+          journal_read(JOURNAL_MEM, reply.sub(1, 16 * n_words), ch);
+          reader_state->reader_stats.n_mem_reads++;
+          reader_state->metrics->add(METRIC_MEM_READS);
+          outcome = CAPTURE_READ;
+        }
+        else
+        {
+          // Header 1 : error code reply
+          if (decoded && reply[0] == 1)
+            GR_LOG_INFO(d_debug_logger, "READ ERROR CODE : " << reply.value(1, 8));
+          reader_state->reader_stats.n_mem_read_fail++;
+          reader_state->metrics->add(METRIC_MEM_READ_FAIL);
+          outcome = CAPTURE_READ_FAIL;
         }
+
+        // Next read with the same handle, or back to inventory
+        ch.h_slot_valid = (mac_event(MAC_EV_READ_DONE) == MAC_CMD_READ);
       }
-      crc_16 = ~crc_16;
 
-      if(rcvd_crc != crc_16)
-        return -1;
-      else
-        return 1;
+      capture_burst(slot, outcome, ch, capture_round, capture_slot);
+      reader_state->bursts->release(slot);
+      return written;
+    }
+
+
+    int
+    tag_decoder_impl::general_work (int noutput_items,
+                       gr_vector_int &ninput_items,
+                       gr_vector_const_void_star &input_items,
+                       gr_vector_void_star &output_items)
+    {
+      const int *in_slots = (const int *) input_items[0];
+      uint16_t *out = (uint16_t *) output_items[0];
+
+      // All the bursts queued by the gate, at most one RN16 item each
+      int n_bursts = std::min(ninput_items[0], noutput_items);
+      int written = 0;
+      for (int b = 0; b < n_bursts; b++)
+        written += decode_burst(in_slots[b], &out[written]);
+
+      produce(0, written);
+      consume_each(n_bursts);
+      return WORK_CALLED_PRODUCE;
     }
   } /* namespace rfid */
 } /* namespace gr */
@@ -24,32 +24,95 @@
 #include <rfid/tag_decoder.h>
 #include <vector>
 #include "rfid/global_vars.h"
+#include "gen2_mac.h"
+#include <rfid/journal.h>
+#include "burst_arena.h"
+#include "burst_capture.h"
+#include "fm0_kernels.h"
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
 #include <time.h>
 #include <numeric>
 #include <fstream>
 namespace gr {
 namespace rfid {
 
+  const int EPC_JOB_QUEUE      = 64;    // EPCs in flight are bounded by the burst arena, the rest are end of rounds
+  const int EPC_WORKER_POLL_US = 100;
+
   class tag_decoder_impl : public tag_decoder
   {
     private:
+
+      // Channel and timing of one Tag reply. The fast path and the EPC worker each have their own.
+      struct reply_channel
+      {
+        gr_complex h_est;
+        gr_complex h_refined;     // Decision-directed estimate over the whole Tag reply
+        gr_complex h_slot;        // Estimate from the RN16 of the current slot (seeds EPC sync)
+        bool       h_slot_valid;
+        float      T;             // Estimated half bit of the last EPC (samples)
+        int        antenna;       // Antenna of the inventory round of the reply
+        uint64_t   time_us;       // RX time of the burst (us since the epoch)
+      };
+
+      // Work of the EPC worker, in slot order
+      enum EPC_JOB_TYPE {EPC_JOB_DECODE, EPC_JOB_END_OF_ROUND};
+      struct epc_job
+      {
+        EPC_JOB_TYPE  type;
+        int           slot;       // Burst arena slot, released by the worker
+        reply_channel ch;
+        bool          collision;  // RN16 of the slot was recovered from a collision
+        int           round, slot_number;
+      };
     
       float n_samples_TAG_BIT;
       int s_rate;
       std::vector<float> pulse_bit;
-      float T_global;
-      gr_complex h_est;
-      char * char_bits;
+      fm0_kernel * d_kernel;    // Sample access specialized on the samples per half bit
+      reply_channel fast_ch;    // Scheduler thread
+      bool slot_collision;      // RN16 of the current slot was recovered from a collision
 
-      std::vector<float> tag_detection_EPC(std::vector<gr_complex> &EPC_samples_complex, int index);
-      std::vector<float> tag_detection_RN16(std::vector<gr_complex> &RN16_samples_complex);      
-      int tag_sync(const gr_complex * in, int size);
-       int check_crc(char * bits, int num_bits);
+      // EPC worker : EPC validation, inventory and statistics off the RN16 -> ACK path
+      bool d_deferred;
+      boost::lockfree::spsc_queue<epc_job, boost::lockfree::capacity<EPC_JOB_QUEUE> > d_jobs;
+      boost::atomic<int> d_jobs_pending;
+      boost::atomic<bool> d_stop;
+      boost::thread d_worker;
+      pmt::pmt_t d_reads_port;  // Message port of the correct EPC reads
+      void push_job(const epc_job & job);
+      void worker();
+
+      epc_bits tag_detection_EPC(const gr_complex * EPC_samples_complex, int size, int index, reply_channel & ch);
+      epc_bits tag_detection_RN16(std::vector<gr_complex> &RN16_samples_complex, reply_channel & ch);      
+      int tag_sync(const gr_complex * in, int size, reply_channel & ch, int exclude_index = -1);
+      int sample_half_bits(const gr_complex * in, int size, int index, int n_half_bits, std::vector<gr_complex> & samples);
+      void cancel_tag(std::vector<gr_complex> & samples, int index, gr_complex h, const epc_bits & bits);
+      bool collision_recovery(const gr_complex * in, int size, int RN16_index, epc_bits & RN16_bits, reply_channel & ch);
+      void update_channel_cache(const epc_bits & epc, const reply_channel & ch, float ampl, float phase);
+      void channel_prior(reply_channel & ch);
+      bool empty_slot(const std::vector<gr_complex> & RN16_samples_complex, const reply_channel & ch);
+      bool decode_reply(const gr_complex * in, int size, int n_bits, epc_bits & bits, reply_channel & ch);
+      CAPTURE_OUTCOME decode_epc(const gr_complex * in, int size, reply_channel & ch, bool collision, int round, epc_bits & epc);
+      void capture_burst(int slot, CAPTURE_OUTCOME outcome, const reply_channel & ch, int round, int slot_number);
+      MAC_COMMAND mac_event(MAC_EVENT event);
+      void end_of_round();
+      void touch_tag(const epc_bits & epc, int round);
+      void evict_tag();
+      int  decode_burst(int slot, uint16_t * out);
+      void update_read_times(const epc_bits & epc, uint64_t time_us);
+      void journal_read(JOURNAL_RECORD_TYPE type, const epc_bits & bits, const reply_channel & ch);
+      void publish_read(const epc_bits & epc, const reply_channel & ch, int round, const float * ampl, const float * phase);
 
     public:
       tag_decoder_impl(int sample_rate, std::vector<int> output_sizes);
       ~tag_decoder_impl();
 
+      // Drains the EPC worker and commits the journaled reads before the flowgraph exits
+      bool stop();
+
       void forecast (int noutput_items, gr_vector_int &ninput_items_required);
 
       int general_work(int noutput_items,